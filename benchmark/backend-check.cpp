@@ -0,0 +1,94 @@
+#include <cstdlib>
+#include <QApplication>
+#include <QGraphicsView>
+#include <QTextStream>
+#include <pal/image-viewer.h>
+#include "benchmark.h"
+
+// Renders test images with the raster and OpenGL backends and compares the
+// viewport pixels. Exits with 77 when OpenGL is not usable, ctest's skip code.
+
+namespace {
+
+struct Setup {
+    const char *name;
+    QImage::Format format;
+    qreal opacity;
+    qreal rotation;
+    int zoom;  // zoomIn() steps from 1:1
+};
+
+QImage renderView(pal::ImageViewer &viewer, pal::ImageViewer::Backend backend, const Setup &setup) {
+    if (!viewer.setBackend(backend))
+        return QImage();
+    viewer.pixmapItem()->setOpacity(setup.opacity);
+    viewer.setRotation(setup.rotation);
+    viewer.zoomOriginal();
+    viewer.zoomIn(setup.zoom);
+    QCoreApplication::processEvents();
+    return viewer.view()->viewport()->grab().toImage().convertToFormat(QImage::Format_RGB32);
+}
+
+// share of the pixels differing by more than a rounding error
+double mismatch(const QImage &a, const QImage &b) {
+    if (a.size() != b.size())
+        return 1.0;
+
+    qint64 count = 0;
+    for (int y = 0; y < a.height(); ++y) {
+        auto la = reinterpret_cast<const QRgb*>(a.constScanLine(y));
+        auto lb = reinterpret_cast<const QRgb*>(b.constScanLine(y));
+        for (int x = 0; x < a.width(); ++x) {
+            if (std::abs(qRed(la[x]) - qRed(lb[x])) > 3 || std::abs(qGreen(la[x]) - qGreen(lb[x])) > 3
+                || std::abs(qBlue(la[x]) - qBlue(lb[x])) > 3)
+                ++count;
+        }
+    }
+    return double(count) / (qint64(a.width()) * a.height());
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QApplication app(argc, argv);
+    QTextStream out(stdout);
+
+    pal::ImageViewer viewer;
+    viewer.setToolBarMode(pal::ImageViewer::ToolBarMode::Hidden);
+    viewer.resize(640, 480);
+    viewer.show();
+    QCoreApplication::processEvents();
+
+    if (!viewer.setBackend(pal::ImageViewer::Backend::OpenGL)) {
+        out << "OpenGL backend not available, skipped\n";
+        return 77;
+    }
+
+    const Setup setups[] = {
+        {"opaque", QImage::Format_RGB32, 1.0, 0., 0},
+        {"alpha", QImage::Format_ARGB32, 1.0, 0., 0},
+        {"opacity", QImage::Format_RGB32, 0.5, 0., 0},
+        {"alpha-opacity", QImage::Format_ARGB32, 0.5, 0., 0},
+        {"zoomed", QImage::Format_RGB32, 1.0, 0., 20},
+        {"rotated", QImage::Format_ARGB32, 1.0, 90., 20},
+    };
+
+    // edges of zoomed pixels may land on either side, a few can differ
+    const double tolerance = 0.005;
+    bool ok = true;
+    for (const Setup &setup : setups) {
+        viewer.setImage(bench::makeImage(QSize(1500, 1100), setup.format));
+        const QImage raster = renderView(viewer, pal::ImageViewer::Backend::Raster, setup);
+        const QImage gl = renderView(viewer, pal::ImageViewer::Backend::OpenGL, setup);
+        const double m = gl.isNull() ? 1.0 : mismatch(raster, gl);
+        out << setup.name << ": " << (m <= tolerance ? "ok" : "FAILED")
+            << ", " << m * 100 << "% of the pixels differ\n";
+        ok = ok && m <= tolerance;
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <vector>
+#include <QElapsedTimer>
+#include <QGuiApplication>
+#include <QStringList>
+#include <QTextStream>
+#include <QThread>
+#include <QVector>
+#include "benchmark.h"
+
+namespace bench {
+
+namespace {
+
+QString paramsToString(const QVariantMap &params) {
+    QStringList items;
+    for (auto it = params.cbegin(); it != params.cend(); ++it)
+        items << QStringLiteral("%1=%2").arg(it.key(), it.value().toString());
+    return items.join(QStringLiteral(", "));
+}
+
+} // namespace
+
+Suite::Suite(int iterations, const QRegularExpression &filter)
+    : m_iterations(std::max(1, iterations))
+    , m_filter(filter)
+{}
+
+int Suite::iterations() const {
+    return m_iterations;
+}
+
+bool Suite::isEnabled(const QString &name) const {
+    return !m_filter.isValid() || m_filter.pattern().isEmpty() || m_filter.match(name).hasMatch();
+}
+
+void Suite::run(const QString &name, const QVariantMap &params,
+                const Function &body, const Function &prepare)
+{
+    if (!isEnabled(name))
+        return;
+
+    // warm-up run, takes care of lazy initializations and cold caches
+    if (prepare)
+        prepare();
+    body();
+
+    std::vector<double> samples;
+    samples.reserve(size_t(m_iterations));
+
+    QElapsedTimer timer;
+    for (int i = 0; i < m_iterations; ++i) {
+        if (prepare)
+            prepare();
+        timer.start();
+        body();
+        samples.push_back(double(timer.nsecsElapsed()) / 1000.0);
+    }
+
+    std::sort(samples.begin(), samples.end());
+    const size_t n = samples.size();
+    const double mean = std::accumulate(samples.begin(), samples.end(), 0.0) / double(n);
+    const double median = (n % 2) ? samples[n / 2] : 0.5 * (samples[n / 2 - 1] + samples[n / 2]);
+    double var = 0.0;
+    for (double s : samples)
+        var += (s - mean) * (s - mean);
+    var /= double(n);
+
+    QJsonObject res;
+    res[QStringLiteral("name")] = name;
+    res[QStringLiteral("params")] = QJsonObject::fromVariantMap(params);
+    res[QStringLiteral("unit")] = QStringLiteral("us");
+    res[QStringLiteral("iterations")] = m_iterations;
+    res[QStringLiteral("min")] = samples.front();
+    res[QStringLiteral("max")] = samples.back();
+    res[QStringLiteral("mean")] = mean;
+    res[QStringLiteral("median")] = median;
+    res[QStringLiteral("stddev")] = std::sqrt(var);
+    res[QStringLiteral("per_second")] = median > 0.0 ? 1e6 / median : 0.0;
+    m_results.append(res);
+
+    QTextStream err(stderr);
+    err << name << " [" << paramsToString(params) << "]: "
+        << QString::number(median, 'f', 1) << " us\n";
+    err.flush();
+}
+
+QJsonObject Suite::toJson() const {
+    QJsonObject root;
+    root[QStringLiteral("suite")] = QStringLiteral("PalImageViewer");
+    root[QStringLiteral("qt_version")] = QString::fromLatin1(qVersion());
+    root[QStringLiteral("platform")] = QGuiApplication::platformName();
+    root[QStringLiteral("threads")] = QThread::idealThreadCount();
+    root[QStringLiteral("iterations")] = m_iterations;
+    root[QStringLiteral("results")] = m_results;
+    return root;
+}
+
+QImage makeImage(const QSize &size, QImage::Format format, int seed) {
+    // gradients with some noise, so that the content is neither constant nor
+    // pure noise, and is identical from one run to another
+    QImage im(size, QImage::Format_ARGB32);
+    quint32 state = 2463534242u + quint32(seed) * 7919u;
+    const int w = std::max(1, im.width() - 1);
+    const int h = std::max(1, im.height() - 1);
+
+    for (int y = 0; y < im.height(); ++y) {
+        auto line = reinterpret_cast<QRgb*>(im.scanLine(y));
+        for (int x = 0; x < im.width(); ++x) {
+            // xorshift32
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            const int noise = int(state & 31) - 16;
+            const int r = qBound(0, (x * 255) / w + noise, 255);
+            const int g = qBound(0, (y * 255) / h + noise, 255);
+            const int b = qBound(0, ((x + y + seed * 37) & 255) + noise, 255);
+            line[x] = qRgba(r, g, b, 255 - ((x ^ y) & 63));
+        }
+    }
+
+    // let Qt quantize to a palette would be slow and not that representative
+    if (format == QImage::Format_Indexed8) {
+        QImage indexed(size, QImage::Format_Indexed8);
+        QVector<QRgb> table(256);
+        for (int i = 0; i < 256; ++i)
+            table[i] = qRgb(i, i, 255 - i);
+        indexed.setColorTable(table);
+
+        for (int y = 0; y < im.height(); ++y) {
+            auto src = reinterpret_cast<const QRgb*>(im.constScanLine(y));
+            auto dst = indexed.scanLine(y);
+            for (int x = 0; x < im.width(); ++x)
+                dst[x] = uchar(qGray(src[x]));
+        }
+        return indexed;
+    }
+
+    return im.convertToFormat(format);
+}
+
+} // namespace bench
@@ -0,0 +1,53 @@
+#pragma once
+#include <functional>
+#include <QImage>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QRegularExpression>
+#include <QString>
+#include <QVariantMap>
+
+namespace bench {
+
+/**
+ * Suite runs timed benchmarks and collects their statistics.
+ *
+ * A benchmark is identified by a name and a set of parameters. It is warmed
+ * up once, then timed for a fixed number of iterations, so that two runs of
+ * the same build on the same machine produce comparable numbers.
+ */
+class Suite {
+public:
+    using Function = std::function<void()>;
+
+    Suite(int iterations, const QRegularExpression &filter);
+
+    /// Number of timed iterations per benchmark
+    int iterations() const;
+
+    /// Whether the benchmark named name passes the filter
+    bool isEnabled(const QString &name) const;
+
+    /**
+     * Time body for every iteration. prepare is called before each
+     * iteration and is not accounted for in the measured time.
+     */
+    void run(const QString &name, const QVariantMap &params,
+             const Function &body, const Function &prepare = Function());
+
+    /// Results of all the benchmarks run so far
+    QJsonObject toJson() const;
+
+private:
+    int m_iterations;
+    QRegularExpression m_filter;
+    QJsonArray m_results;
+};
+
+/// Deterministic test image of the requested size and format
+QImage makeImage(const QSize &size, QImage::Format format, int seed = 0);
+
+/// Benchmark groups, run in order by main()
+void viewerBenchmarks(Suite &suite);
+
+} // namespace bench
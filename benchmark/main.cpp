@@ -0,0 +1,66 @@
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QFile>
+#include <QJsonDocument>
+#include <QTextStream>
+#include "benchmark.h"
+
+int main(int argc, char *argv[])
+{
+    // benchmarks are meant to run headless, unless told otherwise
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QApplication app(argc, argv);
+    QApplication::setApplicationName(QStringLiteral("PalImageViewerBenchmarks"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Pal Image Viewer benchmark suite"));
+    parser.addHelpOption();
+
+    QCommandLineOption output_opt(QStringList{QStringLiteral("o"), QStringLiteral("output")},
+                                  QStringLiteral("Write the JSON results to <file> instead of stdout."),
+                                  QStringLiteral("file"));
+    QCommandLineOption iter_opt(QStringList{QStringLiteral("n"), QStringLiteral("iterations")},
+                                QStringLiteral("Number of timed iterations per benchmark."),
+                                QStringLiteral("count"), QStringLiteral("30"));
+    QCommandLineOption filter_opt(QStringList{QStringLiteral("f"), QStringLiteral("filter")},
+                                  QStringLiteral("Only run benchmarks whose name matches <regex>."),
+                                  QStringLiteral("regex"));
+    parser.addOption(output_opt);
+    parser.addOption(iter_opt);
+    parser.addOption(filter_opt);
+    parser.process(app);
+
+    bool ok = false;
+    const int iterations = parser.value(iter_opt).toInt(&ok);
+    if (!ok || iterations < 1) {
+        QTextStream(stderr) << "Invalid iteration count: " << parser.value(iter_opt) << "\n";
+        return 1;
+    }
+
+    QRegularExpression filter(parser.value(filter_opt));
+    if (!filter.isValid()) {
+        QTextStream(stderr) << "Invalid filter: " << filter.errorString() << "\n";
+        return 1;
+    }
+
+    bench::Suite suite(iterations, filter);
+    bench::viewerBenchmarks(suite);
+
+    const QByteArray json = QJsonDocument(suite.toJson()).toJson(QJsonDocument::Indented);
+
+    if (parser.isSet(output_opt)) {
+        QFile file(parser.value(output_opt));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            QTextStream(stderr) << "Could not write " << file.fileName() << ": " << file.errorString() << "\n";
+            return 1;
+        }
+        file.write(json);
+    }
+    else {
+        QTextStream(stdout) << json;
+    }
+
+    return 0;
+}
@@ -0,0 +1,116 @@
+#include <csignal>
+#include <vector>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTextStream>
+#include <QThread>
+#include <pal/shared-frames.h>
+#include "benchmark.h"
+
+/*
+ * Publishes synthetic frames into a shared memory ring buffer, standing for
+ * an acquisition process. Used by the sharedMemory benchmarks, or by hand to
+ * feed a SharedFrameSource.
+ */
+
+static volatile std::sig_atomic_t stop_requested = 0;
+
+static void requestStop(int) {
+    stop_requested = 1;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("PalImageViewerShmProducer"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Shared memory frame producer"));
+    parser.addHelpOption();
+
+    QCommandLineOption name_opt(QStringList{QStringLiteral("n"), QStringLiteral("name")},
+                                QStringLiteral("Name of the shared memory object."),
+                                QStringLiteral("name"), QStringLiteral("/pal-image-viewer"));
+    QCommandLineOption size_opt(QStringList{QStringLiteral("s"), QStringLiteral("size")},
+                                QStringLiteral("Frame size."),
+                                QStringLiteral("WxH"), QStringLiteral("1920x1080"));
+    QCommandLineOption gray_opt(QStringList{QStringLiteral("g"), QStringLiteral("grayscale")},
+                                QStringLiteral("Publish Grayscale8 frames instead of RGB32 ones."));
+    QCommandLineOption fps_opt(QStringList{QStringLiteral("r"), QStringLiteral("fps")},
+                               QStringLiteral("Frame rate, 0 to publish as fast as possible."),
+                               QStringLiteral("rate"), QStringLiteral("60"));
+    QCommandLineOption slots_opt(QStringList{QStringLiteral("slots")},
+                                 QStringLiteral("Number of ring buffer slots."),
+                                 QStringLiteral("count"), QStringLiteral("4"));
+    QCommandLineOption frames_opt(QStringList{QStringLiteral("frames")},
+                                  QStringLiteral("Stop after that many frames, 0 to run until interrupted."),
+                                  QStringLiteral("count"), QStringLiteral("0"));
+    parser.addOption(name_opt);
+    parser.addOption(size_opt);
+    parser.addOption(gray_opt);
+    parser.addOption(fps_opt);
+    parser.addOption(slots_opt);
+    parser.addOption(frames_opt);
+    parser.process(app);
+
+    const QStringList dims = parser.value(size_opt).split(QLatin1Char('x'));
+    const QSize size = dims.size() == 2 ? QSize(dims[0].toInt(), dims[1].toInt()) : QSize();
+    if (size.isEmpty()) {
+        QTextStream(stderr) << "Invalid frame size: " << parser.value(size_opt) << "\n";
+        return 1;
+    }
+
+    const double fps = parser.value(fps_opt).toDouble();
+    const quint64 frame_count = parser.value(frames_opt).toULongLong();
+    const auto format = parser.isSet(gray_opt) ? QImage::Format_Grayscale8 : QImage::Format_RGB32;
+
+    // a few distinct frames, so that consecutive ones differ
+    std::vector<QImage> frames;
+    for (int f = 0; f < 8; ++f)
+        frames.push_back(bench::makeImage(size, format, f));
+
+    pal::SharedFrameWriter writer;
+    const qint64 frame_bytes = qint64(frames[0].bytesPerLine()) * size.height();
+    if (!writer.create(parser.value(name_opt), parser.value(slots_opt).toInt(), frame_bytes)) {
+        QTextStream(stderr) << "Could not create the ring buffer: " << writer.errorString() << "\n";
+        return 1;
+    }
+
+    // leave through the normal path, which removes the shared memory object
+    std::signal(SIGINT, requestStop);
+    std::signal(SIGTERM, requestStop);
+
+    QTextStream err(stderr);
+    QElapsedTimer clock;
+    clock.start();
+    qint64 last_report = 0;
+    quint64 last_sequence = 0;
+    quint64 sequence = 0;
+
+    while (!stop_requested && (frame_count == 0 || sequence < frame_count)) {
+        sequence = writer.publish(frames[sequence % frames.size()]);
+        if (sequence == 0) {
+            err << "Publishing failed: " << writer.errorString() << "\n";
+            return 1;
+        }
+
+        if (fps > 0) {
+            const qint64 due = qint64(double(sequence) * 1e9 / fps);
+            const qint64 wait = due - clock.nsecsElapsed();
+            if (wait > 0)
+                QThread::usleep(quint64(wait / 1000));
+        }
+
+        const qint64 now = clock.elapsed();
+        if (now - last_report >= 1000) {
+            err << "published " << sequence << " frames, "
+                << double(sequence - last_sequence) * 1000. / double(now - last_report) << " fps\n";
+            err.flush();
+            last_report = now;
+            last_sequence = sequence;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,1070 @@
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <QApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QFileInfo>
+#include <QGraphicsView>
+#include <QGridLayout>
+#include <QProcess>
+#include <QScrollBar>
+#include <QThread>
+#include <QThreadPool>
+#include <pal/compressed-image-cache.h>
+#include <pal/frame-recorder.h>
+#include <pal/image-exporter.h>
+#include <pal/image-viewer.h>
+#include <pal/pyramid-cache.h>
+#include <pal/view-renderer.h>
+#ifdef Q_OS_UNIX
+#include <pal/shared-frames.h>
+#endif
+#include "benchmark.h"
+
+namespace bench {
+
+namespace {
+
+struct Format {
+    const char *name;
+    QImage::Format format;
+};
+
+const std::vector<Format> &imageFormats() {
+    static const std::vector<Format> formats = {
+        {"RGB32", QImage::Format_RGB32},
+        {"ARGB32", QImage::Format_ARGB32},
+        {"ARGB32_Premultiplied", QImage::Format_ARGB32_Premultiplied},
+        {"RGB888", QImage::Format_RGB888},
+        {"Indexed8", QImage::Format_Indexed8},
+        {"Grayscale8", QImage::Format_Grayscale8},
+#if QT_VERSION >= QT_VERSION_CHECK(5, 13, 0)
+        {"Grayscale16", QImage::Format_Grayscale16},
+#endif
+    };
+    return formats;
+}
+
+const std::vector<QSize> &imageSizes() {
+    static const std::vector<QSize> sizes = {
+        {640, 480},
+        {1920, 1080},
+        {4096, 3072},
+    };
+    return sizes;
+}
+
+QString sizeName(const QSize &s) {
+    return QStringLiteral("%1x%2").arg(s.width()).arg(s.height());
+}
+
+// zoom setups used by the paint benchmarks
+struct Zoom {
+    const char *name;
+    int level;  // in ImageViewer zoom steps, ignored when fitting
+    bool fit;
+};
+
+const std::vector<Zoom> &zoomSetups() {
+    static const std::vector<Zoom> zooms = {
+        {"fit", 0, true},
+        {"x0.25", -20, false},
+        {"x1", 0, false},
+        {"x4", 20, false},
+    };
+    return zooms;
+}
+
+void applyZoom(pal::ImageViewer &viewer, const Zoom &zoom) {
+    if (zoom.fit) {
+        viewer.zoomFit();
+    }
+    else {
+        viewer.zoomOriginal();
+        if (zoom.level > 0)
+            viewer.zoomIn(zoom.level);
+        else if (zoom.level < 0)
+            viewer.zoomOut(-zoom.level);
+    }
+    QCoreApplication::processEvents();
+}
+
+// synchronous repaint of the whole view
+void repaint(pal::ImageViewer &viewer) {
+    viewer.view()->viewport()->repaint();
+}
+
+void setImageBenchmarks(Suite &suite, pal::ImageViewer &viewer) {
+    if (!suite.isEnabled(QStringLiteral("setImage")))
+        return;
+
+    for (const auto &size : imageSizes()) {
+        for (const auto &fmt : imageFormats()) {
+            // alternate between two frames to avoid measuring a no-op
+            const QImage frames[2] = {makeImage(size, fmt.format, 0), makeImage(size, fmt.format, 1)};
+            int i = 0;
+
+            suite.run(QStringLiteral("setImage"),
+                      {{QStringLiteral("size"), sizeName(size)},
+                       {QStringLiteral("format"), QString::fromLatin1(fmt.name)}},
+                      [&] { viewer.setImage(frames[i++ % 2]); });
+        }
+    }
+}
+
+// the viewer display path against Qt converting alone, per format
+void conversionBenchmarks(Suite &suite, pal::ImageViewer &viewer) {
+    if (!suite.isEnabled(QStringLiteral("conversion")))
+        return;
+
+    for (const auto &size : imageSizes()) {
+        for (const auto &fmt : imageFormats()) {
+            const QImage frames[2] = {makeImage(size, fmt.format, 0), makeImage(size, fmt.format, 1)};
+            const QVariantMap params = {{QStringLiteral("size"), sizeName(size)},
+                                        {QStringLiteral("format"), QString::fromLatin1(fmt.name)}};
+            int i = 0;
+
+            QVariantMap qt = params;
+            qt.insert(QStringLiteral("path"), QStringLiteral("QPixmap::fromImage"));
+            suite.run(QStringLiteral("conversion"), qt, [&] {
+                const QPixmap pm = QPixmap::fromImage(frames[i++ % 2]);
+                Q_UNUSED(pm)
+            });
+
+            QVariantMap pal = params;
+            pal.insert(QStringLiteral("path"), QStringLiteral("setImage"));
+            suite.run(QStringLiteral("conversion"), pal, [&] { viewer.setImage(frames[i++ % 2]); });
+        }
+    }
+}
+
+void zoomBenchmarks(Suite &suite, pal::ImageViewer &viewer) {
+    const QSize size(4096, 3072);
+    viewer.setImage(makeImage(size, QImage::Format_RGB32));
+    const QVariantMap params = {{QStringLiteral("size"), sizeName(size)}};
+
+    suite.run(QStringLiteral("zoomFit"), params, [&] { viewer.zoomFit(); });
+
+    // zoomIn and zoomOut both boil down to setMatrix()
+    int i = 0;
+    suite.run(QStringLiteral("setMatrix"), params, [&] {
+        if (i++ % 2)
+            viewer.zoomIn();
+        else
+            viewer.zoomOut();
+    });
+}
+
+void paintBenchmarks(Suite &suite, pal::ImageViewer &viewer) {
+    if (!suite.isEnabled(QStringLiteral("paint")))
+        return;
+
+    const QSize size(4096, 3072);
+    viewer.setImage(makeImage(size, QImage::Format_RGB32));
+
+    for (auto backend : {pal::ImageViewer::Backend::Raster, pal::ImageViewer::Backend::OpenGL}) {
+        if (!viewer.setBackend(backend))
+            continue;
+        QCoreApplication::processEvents();
+
+        for (qreal angle : {0., 90., 45.}) {
+            for (const auto &zoom : zoomSetups()) {
+                viewer.setRotation(angle);
+                applyZoom(viewer, zoom);
+
+                suite.run(QStringLiteral("paint"),
+                          {{QStringLiteral("size"), sizeName(size)},
+                           {QStringLiteral("zoom"), QString::fromLatin1(zoom.name)},
+                           {QStringLiteral("rotation"), angle},
+                           {QStringLiteral("backend"), backend == pal::ImageViewer::Backend::OpenGL
+                                                           ? QStringLiteral("opengl") : QStringLiteral("raster")}},
+                          [&] { repaint(viewer); });
+            }
+        }
+    }
+
+    viewer.setBackend(pal::ImageViewer::Backend::Raster);
+    viewer.setRotation(0.);
+    viewer.zoomFit();
+}
+
+// what a ScrollHandDrag does on every mouse move
+void panBenchmarks(Suite &suite, pal::ImageViewer &viewer) {
+    if (!suite.isEnabled(QStringLiteral("pan")))
+        return;
+
+    const QSize size(8192, 6144);
+    viewer.setImage(makeImage(size, QImage::Format_RGB32));
+    auto hbar = viewer.view()->horizontalScrollBar();
+    auto vbar = viewer.view()->verticalScrollBar();
+
+    // the overview sits on the viewport, which still scrolls its pixels
+    for (bool overview : {false, true}) {
+        viewer.setOverviewEnabled(overview);
+
+        for (qreal angle : {0., 90., 45.}) {
+            for (int level : {0, 20}) {
+                viewer.setRotation(angle);
+                viewer.zoomOriginal();
+                viewer.zoomIn(level);
+                hbar->setValue((hbar->minimum() + hbar->maximum()) / 2);
+                vbar->setValue((vbar->minimum() + vbar->maximum()) / 2);
+                QCoreApplication::processEvents();
+                repaint(viewer);
+
+                // go back and forth diagonally so as to stay within the image
+                int i = 0;
+                suite.run(QStringLiteral("pan"),
+                          {{QStringLiteral("size"), sizeName(size)},
+                           {QStringLiteral("zoom"), level ? QStringLiteral("x4") : QStringLiteral("x1")},
+                           {QStringLiteral("rotation"), angle},
+                           {QStringLiteral("overview"), overview}},
+                          [&] {
+                              const int step = (i++ / 16) % 2 ? -12 : 12;
+                              hbar->setValue(hbar->value() + step);
+                              vbar->setValue(vbar->value() + step / 2);
+                              // the view scrolls its pixels, only exposed strips are pending
+                              QCoreApplication::processEvents();
+                          });
+            }
+        }
+    }
+
+    viewer.setOverviewEnabled(false);
+    viewer.setRotation(0.);
+    viewer.zoomFit();
+}
+
+void hoverBenchmarks(Suite &suite, pal::ImageViewer &viewer) {
+    const QSize size(1920, 1080);
+
+    for (const auto &fmt : imageFormats()) {
+        viewer.setImage(makeImage(size, fmt.format));
+
+        // sweep the image diagonally, one readout per iteration
+        int i = 0;
+        suite.run(QStringLiteral("hoverReadout"),
+                  {{QStringLiteral("format"), QString::fromLatin1(fmt.name)}},
+                  [&] {
+                      viewer.mouseAt(i % size.width(), i % size.height());
+                      i += 7;
+                  });
+    }
+}
+
+// loupe updates while hovering, the view itself is not repainted
+void loupeBenchmarks(Suite &suite, pal::ImageViewer &viewer) {
+    if (!suite.isEnabled(QStringLiteral("loupe")))
+        return;
+
+    viewer.setLoupeEnabled(true);
+
+    for (const QSize &size : {QSize(1920, 1080), QSize(8192, 6144)}) {
+        for (const auto &fmt : imageFormats()) {
+            viewer.setImage(makeImage(size, fmt.format));
+
+            int i = 0;
+            suite.run(QStringLiteral("loupe"),
+                      {{QStringLiteral("size"), sizeName(size)},
+                       {QStringLiteral("format"), QString::fromLatin1(fmt.name)}},
+                      [&] {
+                          viewer.mouseAt(i % size.width(), i % size.height());
+                          i += 7;
+                      });
+        }
+    }
+
+    viewer.setLoupeEnabled(false);
+}
+
+// per frame cost of the overview while streaming zoomed in, and of navigating
+void overviewBenchmarks(Suite &suite, pal::ImageViewer &viewer) {
+    if (!suite.isEnabled(QStringLiteral("overview")))
+        return;
+
+    const QSize size(8192, 6144);
+    const QImage frames[2] = {makeImage(size, QImage::Format_RGB32, 0), makeImage(size, QImage::Format_RGB32, 1)};
+    auto hbar = viewer.view()->horizontalScrollBar();
+    auto vbar = viewer.view()->verticalScrollBar();
+
+    for (bool overview : {false, true}) {
+        viewer.setOverviewEnabled(overview);
+        viewer.setImage(frames[0]);
+        viewer.zoomOriginal();
+        viewer.zoomIn(10);
+        QCoreApplication::processEvents();
+
+        int i = 0;
+        suite.run(QStringLiteral("overview"),
+                  {{QStringLiteral("size"), sizeName(size)},
+                   {QStringLiteral("overview"), overview},
+                   {QStringLiteral("change"), QStringLiteral("frame")}},
+                  [&] {
+                      viewer.setImage(frames[i++ % 2]);
+                      QCoreApplication::processEvents();
+                      repaint(viewer);
+                  });
+
+        suite.run(QStringLiteral("overview"),
+                  {{QStringLiteral("size"), sizeName(size)},
+                   {QStringLiteral("overview"), overview},
+                   {QStringLiteral("change"), QStringLiteral("pan")}},
+                  [&] {
+                      const int step = (i++ / 16) % 2 ? -12 : 12;
+                      hbar->setValue(hbar->value() + step);
+                      vbar->setValue(vbar->value() + step / 2);
+                      repaint(viewer);
+                  });
+    }
+
+    viewer.setOverviewEnabled(false);
+    viewer.zoomFit();
+}
+
+void streamingBenchmarks(Suite &suite, pal::ImageViewer &viewer) {
+    if (!suite.isEnabled(QStringLiteral("streaming")))
+        return;
+
+    for (const QSize size : {QSize(1280, 720), QSize(1920, 1080), QSize(3840, 2160)}) {
+        for (auto format : {QImage::Format_RGB32, QImage::Format_Grayscale8}) {
+            std::vector<QImage> frames;
+            for (int f = 0; f < 8; ++f)
+                frames.push_back(makeImage(size, format, f));
+
+            // a streamed frame is only worth something once displayed
+            size_t i = 0;
+            suite.run(QStringLiteral("streaming"),
+                      {{QStringLiteral("size"), sizeName(size)},
+                       {QStringLiteral("format"), format == QImage::Format_RGB32 ? QStringLiteral("RGB32")
+                                                                                 : QStringLiteral("Grayscale8")}},
+                      [&] {
+                          viewer.setImage(frames[i++ % frames.size()]);
+                          repaint(viewer);
+                      });
+        }
+    }
+}
+
+// overhead of the render statistics collection on the streaming path
+void statsBenchmarks(Suite &suite, pal::ImageViewer &viewer) {
+    if (!suite.isEnabled(QStringLiteral("statsOverhead")))
+        return;
+
+    const QSize size(1920, 1080);
+    const QImage frames[2] = {makeImage(size, QImage::Format_RGB32, 0),
+                              makeImage(size, QImage::Format_RGB32, 1)};
+
+    for (bool on : {false, true}) {
+        viewer.setStatsEnabled(on);
+        int i = 0;
+        suite.run(QStringLiteral("statsOverhead"),
+                  {{QStringLiteral("size"), sizeName(size)},
+                   {QStringLiteral("stats"), on}},
+                  [&] {
+                      viewer.setImage(frames[i++ % 2]);
+                      repaint(viewer);
+                  });
+    }
+    viewer.setStatsEnabled(false);
+}
+
+// streams of identical, slightly changing and entirely changing frames
+void fingerprintBenchmarks(Suite &suite, pal::ImageViewer &viewer) {
+    if (!suite.isEnabled(QStringLiteral("fingerprint")))
+        return;
+
+    const QSize size(1920, 1080);
+
+    for (auto format : {QImage::Format_RGB32, QImage::Format_Grayscale8}) {
+        const QImage base = makeImage(size, format, 0);
+        const QImage other = makeImage(size, format, 1);
+
+        // distinct buffers with the same content
+        const QImage identical[2] = {base.copy(), base.copy()};
+
+        // a small moving patch over a static background
+        std::vector<QImage> patched;
+        for (int f = 0; f < 8; ++f) {
+            QImage im = base.copy();
+            const QImage patch = other.copy(f * 100, 200, 96, 96);
+            for (int y = 0; y < patch.height(); ++y)
+                std::memcpy(im.scanLine(200 + y) + f * 100 * im.depth() / 8, patch.constScanLine(y),
+                            size_t(patch.bytesPerLine()));
+            patched.push_back(im);
+        }
+
+        const QImage changing[2] = {base, other};
+
+        struct Scenario {
+            const char *name;
+            std::function<const QImage &(int)> frame;
+        };
+        const Scenario scenarios[] = {
+            {"identical", [&](int i) -> const QImage & { return identical[i % 2]; }},
+            {"patch", [&](int i) -> const QImage & { return patched[size_t(i) % patched.size()]; }},
+            {"changing", [&](int i) -> const QImage & { return changing[i % 2]; }},
+        };
+
+        for (bool on : {false, true}) {
+            viewer.setFingerprintingEnabled(on);
+            for (const auto &scenario : scenarios) {
+                int i = 0;
+                viewer.setImage(scenario.frame(i++));
+                repaint(viewer);
+
+                suite.run(QStringLiteral("fingerprint"),
+                          {{QStringLiteral("size"), sizeName(size)},
+                           {QStringLiteral("format"), format == QImage::Format_RGB32 ? QStringLiteral("RGB32")
+                                                                                     : QStringLiteral("Grayscale8")},
+                           {QStringLiteral("frames"), QString::fromLatin1(scenario.name)},
+                           {QStringLiteral("fingerprint"), on}},
+                          [&] {
+                              viewer.setImage(scenario.frame(i++));
+                              repaint(viewer);
+                          });
+            }
+        }
+    }
+
+    viewer.setFingerprintingEnabled(false);
+}
+
+// raw sensor frames, demosaiced tile by tile for what is on screen
+void bayerBenchmarks(Suite &suite, pal::ImageViewer &viewer) {
+    if (!suite.isEnabled(QStringLiteral("bayer")))
+        return;
+
+    const QSize size(4096, 3072);
+    std::vector<Format> formats = {{"Grayscale8", QImage::Format_Grayscale8}};
+#if QT_VERSION >= QT_VERSION_CHECK(5, 13, 0)
+    formats.push_back({"Grayscale16", QImage::Format_Grayscale16});
+#endif
+
+    viewer.setBayerPattern(pal::BayerPattern::RGGB);
+
+    for (const auto &fmt : formats) {
+        const QImage frames[2] = {makeImage(size, fmt.format, 0), makeImage(size, fmt.format, 1)};
+
+        for (const auto &zoom : zoomSetups()) {
+            const QVariantMap params = {{QStringLiteral("size"), sizeName(size)},
+                                        {QStringLiteral("format"), QString::fromLatin1(fmt.name)},
+                                        {QStringLiteral("zoom"), QString::fromLatin1(zoom.name)}};
+            int i = 0;
+            viewer.setImage(frames[i++ % 2]);
+            applyZoom(viewer, zoom);
+
+            // a stream, every frame demosaiced bilinearly
+            QVariantMap live = params;
+            live.insert(QStringLiteral("mode"), QStringLiteral("live"));
+            suite.run(QStringLiteral("bayer"), live, [&] {
+                viewer.setImage(frames[i++ % 2]);
+                repaint(viewer);
+            });
+
+            // a still frame, refined once the delay elapsed
+            QVariantMap still = params;
+            still.insert(QStringLiteral("mode"), QStringLiteral("refined"));
+            suite.run(QStringLiteral("bayer"), still,
+                      [&] {
+                          QCoreApplication::processEvents();
+                          repaint(viewer);
+                      },
+                      [&] {
+                          viewer.setImage(frames[i++ % 2]);
+                          QThread::msleep(250);
+                      });
+        }
+    }
+
+    viewer.setBayerPattern(pal::BayerPattern::None);
+    viewer.zoomFit();
+}
+
+// local contrast enhancement, for new frames and for pans over cached tiles
+void claheBenchmarks(Suite &suite, pal::ImageViewer &viewer) {
+    if (!suite.isEnabled(QStringLiteral("clahe")))
+        return;
+
+    const QSize size(8192, 6144);
+    const QImage frames[2] = {makeImage(size, QImage::Format_Grayscale8, 0),
+                              makeImage(size, QImage::Format_Grayscale8, 1)};
+    auto hbar = viewer.view()->horizontalScrollBar();
+    auto vbar = viewer.view()->verticalScrollBar();
+
+    viewer.setLocalContrastEnabled(true);
+
+    for (const auto &zoom : zoomSetups()) {
+        const QVariantMap params = {{QStringLiteral("size"), sizeName(size)},
+                                    {QStringLiteral("zoom"), QString::fromLatin1(zoom.name)}};
+        int i = 0;
+        viewer.setImage(frames[i++ % 2]);
+        applyZoom(viewer, zoom);
+
+        QVariantMap frame = params;
+        frame.insert(QStringLiteral("change"), QStringLiteral("frame"));
+        suite.run(QStringLiteral("clahe"), frame, [&] {
+            viewer.setImage(frames[i++ % 2]);
+            repaint(viewer);
+        });
+
+        QVariantMap pan = params;
+        pan.insert(QStringLiteral("change"), QStringLiteral("pan"));
+        suite.run(QStringLiteral("clahe"), pan, [&] {
+            const int step = (i++ / 16) % 2 ? -12 : 12;
+            hbar->setValue(hbar->value() + step);
+            vbar->setValue(vbar->value() + step / 2);
+            repaint(viewer);
+        });
+    }
+
+    viewer.setLocalContrastEnabled(false);
+    viewer.zoomFit();
+}
+
+// channel changes of a multi-channel composite, repainted right away
+void compositeBenchmarks(Suite &suite, pal::ImageViewer &viewer) {
+    if (!suite.isEnabled(QStringLiteral("composite")))
+        return;
+
+    const QSize size(4096, 4096);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 13, 0)
+    const auto format = QImage::Format_Grayscale16;
+    const int high = 65535;
+#else
+    const auto format = QImage::Format_Grayscale8;
+    const int high = 255;
+#endif
+    const QColor colors[] = {Qt::blue, Qt::green, Qt::red, Qt::magenta};
+
+
+    for (int count : {2, 4}) {
+        QVector<pal::CompositeChannel> channels;
+        for (int c = 0; c < count; ++c) {
+            pal::CompositeChannel channel;
+            channel.image = makeImage(size, format, c);
+            channel.color = colors[c];
+            channel.high = high;
+            channels.append(channel);
+        }
+        viewer.setComposite(channels);
+
+        for (const auto &zoom : zoomSetups()) {
+            applyZoom(viewer, zoom);
+            const QVariantMap params = {{QStringLiteral("size"), sizeName(size)},
+                                        {QStringLiteral("channels"), count},
+                                        {QStringLiteral("zoom"), QString::fromLatin1(zoom.name)}};
+
+            int i = 0;
+            QVariantMap toggle = params;
+            toggle.insert(QStringLiteral("change"), QStringLiteral("visibility"));
+            suite.run(QStringLiteral("composite"), toggle, [&] {
+                pal::CompositeChannel channel = viewer.compositeChannels().at(1);
+                channel.visible = i++ % 2;
+                viewer.setCompositeChannel(1, channel);
+                repaint(viewer);
+            });
+
+            QVariantMap range = params;
+            range.insert(QStringLiteral("change"), QStringLiteral("range"));
+            suite.run(QStringLiteral("composite"), range, [&] {
+                pal::CompositeChannel channel = viewer.compositeChannels().at(0);
+                channel.high = high - (i++ % 64) * (high / 128);
+                viewer.setCompositeChannel(0, channel);
+                repaint(viewer);
+            });
+        }
+    }
+
+    viewer.setImage(makeImage(QSize(1920, 1080), QImage::Format_RGB32));
+    viewer.zoomFit();
+}
+
+// planes of a YUV frame and the frame describing them
+struct YuvBuffers {
+    std::vector<uchar> planes[3];
+    pal::YuvFrame frame;
+};
+
+// BT.601 limited range frame in a given layout, from a test image
+std::unique_ptr<YuvBuffers> makeYuv(const QSize &size, pal::YuvFrame::Layout layout, int seed) {
+    const QImage rgb = makeImage(size, QImage::Format_RGB32, seed);
+    const int w = size.width();
+    const int h = size.height();
+    const int cw = (w + 1) / 2;
+    const int ch = (h + 1) / 2;
+
+    std::unique_ptr<YuvBuffers> yuv(new YuvBuffers);
+    auto &f = yuv->frame;
+    f.layout = layout;
+    f.size = size;
+
+    auto luma = [](QRgb c) { return uchar((66 * qRed(c) + 129 * qGreen(c) + 25 * qBlue(c) + 128) / 256 + 16); };
+    auto cb = [](QRgb c) { return uchar((-38 * qRed(c) - 74 * qGreen(c) + 112 * qBlue(c) + 128) / 256 + 128); };
+    auto cr = [](QRgb c) { return uchar((112 * qRed(c) - 94 * qGreen(c) - 18 * qBlue(c) + 128) / 256 + 128); };
+
+    if (layout == pal::YuvFrame::Layout::YUYV) {
+        yuv->planes[0].resize(size_t(w) * 2 * size_t(h));
+        for (int y = 0; y < h; ++y) {
+            auto line = reinterpret_cast<const QRgb*>(rgb.constScanLine(y));
+            uchar *out = yuv->planes[0].data() + y * w * 2;
+            for (int x = 0; x < w; ++x) {
+                out[2 * x] = luma(line[x]);
+                out[2 * x + 1] = x % 2 ? cr(line[x - 1]) : cb(line[x]);
+            }
+        }
+        f.strides[0] = w * 2;
+    }
+    else {
+        const bool nv12 = layout == pal::YuvFrame::Layout::NV12;
+        yuv->planes[0].resize(size_t(w) * size_t(h));
+        yuv->planes[1].resize(size_t(cw) * size_t(ch) * (nv12 ? 2 : 1));
+        yuv->planes[2].resize(nv12 ? 0 : size_t(cw) * size_t(ch));
+        for (int y = 0; y < h; ++y) {
+            auto line = reinterpret_cast<const QRgb*>(rgb.constScanLine(y));
+            for (int x = 0; x < w; ++x) {
+                yuv->planes[0][size_t(y * w + x)] = luma(line[x]);
+                if (x % 2 || y % 2)
+                    continue;
+                const size_t c = size_t((y / 2) * cw + x / 2);
+                if (nv12) {
+                    yuv->planes[1][2 * c] = cb(line[x]);
+                    yuv->planes[1][2 * c + 1] = cr(line[x]);
+                }
+                else {
+                    yuv->planes[1][c] = cb(line[x]);
+                    yuv->planes[2][c] = cr(line[x]);
+                }
+            }
+        }
+        f.strides[0] = w;
+        f.strides[1] = nv12 ? cw * 2 : cw;
+        f.strides[2] = nv12 ? 0 : cw;
+    }
+
+    for (int i = 0; i < 3; ++i)
+        f.planes[i] = yuv->planes[i].empty() ? nullptr : yuv->planes[i].data();
+    return yuv;
+}
+
+// what callers had to do before: a scalar conversion to RGB32, then setImage
+QImage yuvToRgb(const pal::YuvFrame &f) {
+    QImage im(f.size, QImage::Format_RGB32);
+    for (int y = 0; y < im.height(); ++y) {
+        auto out = reinterpret_cast<QRgb*>(im.scanLine(y));
+        for (int x = 0; x < im.width(); ++x) {
+            int Y, U, V;
+            if (f.layout == pal::YuvFrame::Layout::YUYV) {
+                const uchar *p = f.planes[0] + y * f.strides[0];
+                Y = p[2 * x];
+                U = p[(x / 2) * 4 + 1];
+                V = p[(x / 2) * 4 + 3];
+            }
+            else if (f.layout == pal::YuvFrame::Layout::NV12) {
+                const uchar *uv = f.planes[1] + (y / 2) * f.strides[1] + (x / 2) * 2;
+                Y = f.planes[0][y * f.strides[0] + x];
+                U = uv[0];
+                V = uv[1];
+            }
+            else {
+                Y = f.planes[0][y * f.strides[0] + x];
+                U = f.planes[1][(y / 2) * f.strides[1] + x / 2];
+                V = f.planes[2][(y / 2) * f.strides[2] + x / 2];
+            }
+            const int c = 298 * (Y - 16) + 128;
+            out[x] = qRgb(qBound(0, (c + 409 * (V - 128)) >> 8, 255),
+                          qBound(0, (c - 100 * (U - 128) - 208 * (V - 128)) >> 8, 255),
+                          qBound(0, (c + 516 * (U - 128)) >> 8, 255));
+        }
+    }
+    return im;
+}
+
+// YUV frames set directly, against a conversion by the caller
+void yuvBenchmarks(Suite &suite, pal::ImageViewer &viewer) {
+    if (!suite.isEnabled(QStringLiteral("yuv")))
+        return;
+
+    struct Layout {
+        const char *name;
+        pal::YuvFrame::Layout layout;
+    };
+    const Layout layouts[] = {
+        {"NV12", pal::YuvFrame::Layout::NV12},
+        {"I420", pal::YuvFrame::Layout::I420},
+        {"YUYV", pal::YuvFrame::Layout::YUYV},
+    };
+
+    for (const auto &size : imageSizes()) {
+        for (const auto &layout : layouts) {
+            const std::unique_ptr<YuvBuffers> frames[2] = {makeYuv(size, layout.layout, 0),
+                                                           makeYuv(size, layout.layout, 1)};
+            const QVariantMap params = {{QStringLiteral("size"), sizeName(size)},
+                                        {QStringLiteral("layout"), QString::fromLatin1(layout.name)}};
+            int i = 0;
+
+            QVariantMap native = params;
+            native.insert(QStringLiteral("path"), QStringLiteral("setYuvImage"));
+            suite.run(QStringLiteral("yuv"), native, [&] { viewer.setYuvImage(frames[i++ % 2]->frame); });
+
+            QVariantMap converted = params;
+            converted.insert(QStringLiteral("path"), QStringLiteral("caller conversion"));
+            suite.run(QStringLiteral("yuv"), converted, [&] { viewer.setImage(yuvToRgb(frames[i++ % 2]->frame)); });
+        }
+    }
+}
+
+// live display path through a recorder, kept in memory and spilled to disk
+void recorderBenchmarks(Suite &suite, pal::ImageViewer &viewer) {
+    if (!suite.isEnabled(QStringLiteral("recording")))
+        return;
+
+    const QSize size(1920, 1080);
+    std::vector<QImage> frames;
+    for (int f = 0; f < 8; ++f)
+        frames.push_back(makeImage(size, QImage::Format_RGB32, f));
+
+    const QString spill = QDir::temp().filePath(
+        QStringLiteral("pal-benchmark-%1.rec").arg(QCoreApplication::applicationPid()));
+
+    for (const char *mode : {"none", "memory", "spill"}) {
+        pal::FrameRecorder recorder;
+        const bool recording = std::strcmp(mode, "none") != 0;
+        if (std::strcmp(mode, "spill") == 0 && !recorder.startSpill(spill)) {
+            qWarning("recording: could not spill to %s: %s", qPrintable(spill), qPrintable(recorder.errorString()));
+            continue;
+        }
+        QObject::connect(&recorder, &pal::FrameRecorder::frameReady, &viewer, &pal::ImageViewer::setImage);
+
+        size_t i = 0;
+        suite.run(QStringLiteral("recording"),
+                  {{QStringLiteral("size"), sizeName(size)},
+                   {QStringLiteral("recorder"), QString::fromLatin1(mode)}},
+                  [&] {
+                      const QImage &frame = frames[i++ % frames.size()];
+                      if (recording)
+                          recorder.record(frame);
+                      else
+                          viewer.setImage(frame);
+                      repaint(viewer);
+                  });
+
+        recorder.stopSpill();
+        QFile::remove(spill);
+    }
+}
+
+// frames streamed from another process, delivered and painted as soon as published
+void sharedMemoryBenchmarks(Suite &suite, pal::ImageViewer &viewer) {
+#ifdef Q_OS_UNIX
+    if (!suite.isEnabled(QStringLiteral("sharedMemory")))
+        return;
+
+    const QString producer = QCoreApplication::applicationDirPath() + QStringLiteral("/PalImageViewerShmProducer");
+    if (!QFileInfo(producer).isExecutable()) {
+        qWarning("sharedMemory: %s not found, skipped", qPrintable(producer));
+        return;
+    }
+
+    const QString name = QStringLiteral("/pal-benchmark-%1").arg(QCoreApplication::applicationPid());
+
+    for (const QSize size : {QSize(1920, 1080), QSize(3840, 2160)}) {
+        QProcess process;
+        process.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+        process.start(producer, {QStringLiteral("--name"), name,
+                                 QStringLiteral("--size"), sizeName(size),
+                                 QStringLiteral("--fps"), QStringLiteral("0")});
+
+        // the ring buffer shows up once the producer is ready
+        pal::SharedFrameSource source;
+        source.setPollInterval(0);
+        QElapsedTimer timeout;
+        timeout.start();
+        while (!source.open(name) && timeout.elapsed() < 5000)
+            QThread::msleep(10);
+
+        if (source.isOpen()) {
+            QObject::connect(&source, &pal::SharedFrameSource::frameReady, &viewer, &pal::ImageViewer::setImage);
+            suite.run(QStringLiteral("sharedMemory"),
+                      {{QStringLiteral("size"), sizeName(size)}},
+                      [&] {
+                          while (!source.poll())
+                              QThread::yieldCurrentThread();
+                          repaint(viewer);
+                      });
+            qInfo("sharedMemory %s: %llu frames, %llu overruns, last latency %.3f ms",
+                  qPrintable(sizeName(size)), source.framesReceived(), source.overruns(),
+                  double(source.latency()) / 1e6);
+            source.close();
+        }
+        else {
+            qWarning("sharedMemory: could not attach to the producer: %s", qPrintable(source.errorString()));
+        }
+
+        process.terminate();
+        process.waitForFinished();
+    }
+#else
+    Q_UNUSED(suite)
+    Q_UNUSED(viewer)
+#endif
+}
+
+// batches of previews rendered without a viewer, on 1 thread and on all cores
+void headlessBenchmarks(Suite &suite) {
+    if (!suite.isEnabled(QStringLiteral("headless")))
+        return;
+
+    const QSize size(4096, 3072);
+    const QVector<QImage> images(16, makeImage(size, QImage::Format_RGB32));
+    QThreadPool *pool = QThreadPool::globalInstance();
+    const int cores = QThread::idealThreadCount();
+
+    pal::ViewParameters params;
+    params.size = QSize(512, 384);
+    pal::ViewOverlay overlay;
+    overlay.shape.addRect(QRectF(1024, 768, 2048, 1536));
+    overlay.text = QStringLiteral("selection");
+    params.overlays.append(overlay);
+
+    for (int threads : {1, cores}) {
+        pool->setMaxThreadCount(threads);
+        for (qreal rotation : {0., 30.}) {
+            params.rotation = rotation;
+            suite.run(QStringLiteral("headless"),
+                      {{QStringLiteral("size"), sizeName(size)},
+                       {QStringLiteral("images"), images.size()},
+                       {QStringLiteral("rotation"), rotation},
+                       {QStringLiteral("threads"), threads}},
+                      [&] { pal::renderViews(images, params); });
+        }
+    }
+
+    pool->setMaxThreadCount(cores);
+}
+
+// stack slices compressed on insertion and shown from the cache, the hot
+// tiles being dropped before every paint so that they get decompressed
+void compressedCacheBenchmarks(Suite &suite, pal::ImageViewer &viewer) {
+    if (!suite.isEnabled(QStringLiteral("compressedCache")))
+        return;
+
+    const QSize size(4096, 3072);
+
+    for (const auto &fmt : imageFormats()) {
+        pal::CompressedImageCache cache;
+        const QImage slices[2] = {makeImage(size, fmt.format, 0), makeImage(size, fmt.format, 1)};
+        const QVariantMap params = {{QStringLiteral("size"), sizeName(size)},
+                                    {QStringLiteral("format"), QString::fromLatin1(fmt.name)},
+                                    {QStringLiteral("lz4"), pal::CompressedImageCache::isLz4Enabled()}};
+
+        int i = 0;
+        QVariantMap insert = params;
+        insert.insert(QStringLiteral("operation"), QStringLiteral("insert"));
+        suite.run(QStringLiteral("compressedCache"), insert, [&] {
+            cache.insert(quint64(i % 2), slices[i % 2]);
+            ++i;
+        });
+
+        for (const auto &zoom : zoomSetups()) {
+            viewer.setCachedImage(cache, 0);
+            applyZoom(viewer, zoom);
+
+            QVariantMap show = params;
+            show.insert(QStringLiteral("operation"), QStringLiteral("show"));
+            show.insert(QStringLiteral("zoom"), QString::fromLatin1(zoom.name));
+            suite.run(QStringLiteral("compressedCache"), show,
+                      [&] {
+                          viewer.setCachedImage(cache, quint64(i++ % 2));
+                          repaint(viewer);
+                      },
+                      [&] {
+                          cache.setHotCapacity(0);
+                          cache.setHotCapacity(64 * 1024 * 1024);
+                      });
+        }
+    }
+
+    viewer.setImage(makeImage(QSize(1920, 1080), QImage::Format_RGB32));
+    viewer.zoomFit();
+}
+
+// pyramids built once, then reopened from their mapped files
+void pyramidCacheBenchmarks(Suite &suite, pal::ImageViewer &viewer) {
+    if (!suite.isEnabled(QStringLiteral("pyramidCache")))
+        return;
+
+    const QSize size(8192, 8192);
+    const QImage image = makeImage(size, QImage::Format_RGB32);
+    const QString dir = QDir::temp().filePath(
+        QStringLiteral("pal-benchmark-%1-pyramids").arg(QCoreApplication::applicationPid()));
+
+    // pyramids are keyed by the file they come from, any content will do
+    const QString path = dir + QStringLiteral("/image.raw");
+    QDir().mkpath(dir);
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write("image") != 5) {
+        qWarning("pyramidCache: could not write %s", qPrintable(path));
+        return;
+    }
+    file.close();
+
+    pal::PyramidCache cache(dir);
+    const QVariantMap params = {{QStringLiteral("size"), sizeName(size)}};
+
+    QVariantMap insert = params;
+    insert.insert(QStringLiteral("operation"), QStringLiteral("insert"));
+    suite.run(QStringLiteral("pyramidCache"), insert, [&] {
+        if (!cache.insert(path, image))
+            qWarning("pyramidCache: %s", qPrintable(cache.errorString()));
+    });
+
+    for (const auto &zoom : zoomSetups()) {
+        viewer.setPyramid(cache, path);
+        applyZoom(viewer, zoom);
+
+        QVariantMap open = params;
+        open.insert(QStringLiteral("operation"), QStringLiteral("open"));
+        open.insert(QStringLiteral("zoom"), QString::fromLatin1(zoom.name));
+        suite.run(QStringLiteral("pyramidCache"), open, [&] {
+            viewer.setPyramid(cache, path);
+            repaint(viewer);
+        });
+    }
+
+    viewer.setImage(makeImage(QSize(1920, 1080), QImage::Format_RGB32));
+    viewer.zoomFit();
+    cache.clear();
+    QDir(dir).removeRecursively();
+}
+
+// selection exports, time spent on the calling thread and whole exports
+void exportBenchmarks(Suite &suite) {
+    if (!suite.isEnabled(QStringLiteral("export")))
+        return;
+
+    const QImage image = makeImage(QSize(8192, 8192), QImage::Format_RGB32);
+    const QRect area(1024, 1024, 4096, 4096);
+    const QVariantMap params = {{QStringLiteral("size"), sizeName(area.size())}};
+
+    QVariantMap copy = params;
+    copy.insert(QStringLiteral("operation"), QStringLiteral("copy"));
+    suite.run(QStringLiteral("export"), copy, [&] { image.copy(area); });
+
+    QVariantMap view = params;
+    view.insert(QStringLiteral("operation"), QStringLiteral("view"));
+    suite.run(QStringLiteral("export"), view, [&] { pal::imageView(image, area); });
+
+    pal::ImageExporter exporter;
+    auto wait = [&] {
+        while (exporter.isBusy())
+            QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+    };
+
+    const QString path = QDir::temp().filePath(
+        QStringLiteral("pal-benchmark-%1-export").arg(QCoreApplication::applicationPid()));
+    using ExportFormat = std::pair<const char*, pal::ImageExporter::Format>;
+    for (auto format : {ExportFormat{"png", pal::ImageExporter::Format::Png},
+                        ExportFormat{"tiff", pal::ImageExporter::Format::Tiff},
+                        ExportFormat{"raw", pal::ImageExporter::Format::Raw}}) {
+        QVariantMap start = params;
+        start.insert(QStringLiteral("operation"), QStringLiteral("start"));
+        start.insert(QStringLiteral("format"), QString::fromLatin1(format.first));
+        suite.run(QStringLiteral("export"), start,
+                  [&] { exporter.save(pal::imageView(image, area), path, format.second); },
+                  wait);
+        wait();
+
+        QVariantMap whole = params;
+        whole.insert(QStringLiteral("operation"), QStringLiteral("whole"));
+        whole.insert(QStringLiteral("format"), QString::fromLatin1(format.first));
+        suite.run(QStringLiteral("export"), whole, [&] {
+            if (exporter.save(pal::imageView(image, area), path, format.second))
+                wait();
+        });
+    }
+    QFile::remove(path);
+}
+
+// contact sheet like walls of viewers
+void constructionBenchmarks(Suite &suite) {
+    if (!suite.isEnabled(QStringLiteral("construction")))
+        return;
+
+    const int count = 200;
+    const int columns = 20;
+    std::unique_ptr<QWidget> wall;
+
+    for (auto mode : {pal::ImageViewer::ToolBarMode::Visible, pal::ImageViewer::ToolBarMode::AutoHidden}) {
+        for (bool shown : {false, true}) {
+            auto build = [&] {
+                auto grid = new QGridLayout(wall.get());
+                for (int i = 0; i < count; ++i) {
+                    auto viewer = new pal::ImageViewer;
+                    viewer->setToolBarMode(mode);
+                    grid->addWidget(viewer, i / columns, i % columns);
+                }
+                if (shown) {
+                    wall->show();
+                    QCoreApplication::processEvents();
+                }
+            };
+
+            auto reset = [&] {
+                wall.reset(new QWidget);
+                wall->resize(1600, 1000);
+            };
+
+            // object count per viewer, a proxy for the memory footprint
+            reset();
+            build();
+            const int objects = int(wall->findChildren<QObject*>().size()) / count;
+
+            suite.run(QStringLiteral("construction"),
+                      {{QStringLiteral("viewers"), count},
+                       {QStringLiteral("toolbar"), mode == pal::ImageViewer::ToolBarMode::Visible
+                                                       ? QStringLiteral("visible") : QStringLiteral("autohidden")},
+                       {QStringLiteral("shown"), shown},
+                       {QStringLiteral("objects_per_viewer"), objects}},
+                      build, reset);
+        }
+    }
+}
+
+} // namespace
+
+void viewerBenchmarks(Suite &suite) {
+    constructionBenchmarks(suite);
+    headlessBenchmarks(suite);
+
+    pal::ImageViewer viewer;
+    viewer.resize(1280, 800);
+    viewer.show();
+    QCoreApplication::processEvents();
+
+    setImageBenchmarks(suite, viewer);
+    conversionBenchmarks(suite, viewer);
+    zoomBenchmarks(suite, viewer);
+    paintBenchmarks(suite, viewer);
+    panBenchmarks(suite, viewer);
+    hoverBenchmarks(suite, viewer);
+    loupeBenchmarks(suite, viewer);
+    overviewBenchmarks(suite, viewer);
+    streamingBenchmarks(suite, viewer);
+    statsBenchmarks(suite, viewer);
+    fingerprintBenchmarks(suite, viewer);
+    bayerBenchmarks(suite, viewer);
+    yuvBenchmarks(suite, viewer);
+    compositeBenchmarks(suite, viewer);
+    claheBenchmarks(suite, viewer);
+    compressedCacheBenchmarks(suite, viewer);
+    pyramidCacheBenchmarks(suite, viewer);
+    exportBenchmarks(suite);
+    recorderBenchmarks(suite, viewer);
+    sharedMemoryBenchmarks(suite, viewer);
+}
+
+} // namespace bench
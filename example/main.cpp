@@ -8,7 +8,11 @@
 #include <QFileDialog>
 #include <QImageReader>
 #include <QGraphicsView>
+#include <QMessageBox>
+#include <QProgressBar>
 #include <QPropertyAnimation>
+#include <QStatusBar>
+#include <pal/image-exporter.h>
 #include <pal/image-viewer.h>
 #include "rect-selection.h"
 
@@ -64,8 +68,54 @@ public:
             viewer->setImage(QImage(path));
         });
 
+        // selection export, encoded and written in the background
+        auto exporter = new pal::ImageExporter(this);
+        auto export_progress = new QProgressBar(this);
+        export_progress->setRange(0, 100);
+        export_progress->setMaximumWidth(200);
+        export_progress->hide();
+        statusBar()->addPermanentWidget(export_progress);
+
+        auto export_action = new QAction(tr("Export the selection..."), this);
+        auto cancel_export_action = new QAction(tr("Cancel the export"), this);
+        auto update_export = [=] {
+            export_action->setEnabled(sel->isChecked() && !exporter->isBusy());
+            cancel_export_action->setEnabled(exporter->isBusy());
+            export_progress->setVisible(exporter->isBusy());
+        };
+
+        connect(export_action, &QAction::triggered, this, [=] {
+            QString path = QFileDialog::getSaveFileName(nullptr, tr("Export the selection"), nullptr,
+                                                        tr("Images (*.png *.tif *.tiff *.raw)"));
+            if (path.isEmpty())
+                return;
+
+            // a view of the selected pixels, not a copy
+            const QImage selection = pal::imageView(viewer->image(), selecter->selectedArea());
+            if (!exporter->save(selection, path)) {
+                QMessageBox::warning(this, tr("Export"), exporter->errorString());
+                return;
+            }
+            export_progress->setValue(0);
+            statusBar()->showMessage(tr("Exporting %1x%2 pixels to %3")
+                                     .arg(selection.width()).arg(selection.height()).arg(path));
+            update_export();
+        });
+        connect(cancel_export_action, &QAction::triggered, exporter, &pal::ImageExporter::cancel);
+        connect(exporter, &pal::ImageExporter::progress, export_progress, [=](double done) {
+            export_progress->setValue(int(done * 100));
+        });
+        connect(exporter, &pal::ImageExporter::finished, this, [=](bool ok) {
+            statusBar()->showMessage(ok ? tr("Export done") : tr("Export failed: %1").arg(exporter->errorString()), 5000);
+            update_export();
+        });
+        connect(sel, &QToolButton::toggled, this, update_export);
+        update_export();
+
         auto file_menu = menuBar()->addMenu(tr("&File"));
         file_menu->addAction(open_action);
+        file_menu->addAction(export_action);
+        file_menu->addAction(cancel_export_action);
 
         auto scrollbar_actions = new QActionGroup(this);
         scrollbar_actions->setExclusive(true);
@@ -185,6 +185,10 @@ QRectF SelectionItem::selection() const {
     return m_rect->rect();
 }
 
+QRect SelectionItem::selectedArea() const {
+    return selection().toAlignedRect() & m_rect->parentItem()->boundingRect().toAlignedRect();
+}
+
 void SelectionItem::setSelection(const QRectF &sel) {
    m_l = sel.left();
    m_r = sel.right();
@@ -23,6 +23,9 @@ class SelectionItem : public QGraphicsObject {
         double bottom() const;
         QRectF selection() const;
 
+        /// pixels of the parent covered by the selection, clipped to it
+        QRect selectedArea() const;
+
         /// Pen used to draw the selection rectangle
         QPen pen() const;
         void setPen(const QPen &p);
@@ -0,0 +1,90 @@
+#ifndef PAL_COMPRESSED_IMAGE_CACHE_H
+#define PAL_COMPRESSED_IMAGE_CACHE_H
+
+#include <memory>
+#include <QImage>
+#include <QList>
+#include <pal/image-viewer-export.h>
+
+namespace pal {
+
+class PixmapItem;
+
+namespace detail {
+class CompressedStore;
+class TileSource;
+}
+
+/**
+ * @brief Compressed image cache statistics, durations are in nanoseconds
+ */
+struct CacheStats {
+    int images = 0;                      ///< images held
+    qint64 rawBytes = 0;                 ///< uncompressed size of the images held
+    qint64 compressedBytes = 0;          ///< memory held by their compressed tiles
+    double compressionRatio = 0.;        ///< raw over compressed size
+    qint64 hotBytes = 0;                 ///< memory held by decompressed tiles
+    quint64 tilesDecompressed = 0;       ///< tiles decompressed
+    quint64 hotHits = 0;                 ///< tiles found decompressed already
+    qint64 decompressionTime = 0;        ///< total time spent decompressing
+    qint64 averageDecompressionTime = 0; ///< mean time to decompress a tile
+};
+
+
+/**
+ * @brief CompressedImageCache keeps many images compressed in memory, for stacks and history
+ *
+ * Images are split in 256x256 tiles, compressed with LZ4, or zlib if the
+ * library was built without it, on the global thread pool. Viewers display
+ * them with PixmapItem::setCachedImage(), which only decompresses the visible
+ * tiles, when painted and on worker threads. Recently decompressed tiles are
+ * kept in a hot cache shared by all the viewers.
+ *
+ * The cache is thread-safe. Images shown by a viewer stay displayable once
+ * evicted or removed.
+ */
+class PAL_IMAGE_VIEWER_EXPORT CompressedImageCache {
+public:
+    CompressedImageCache();
+    ~CompressedImageCache();
+
+    CompressedImageCache(const CompressedImageCache &) = delete;
+    CompressedImageCache& operator=(const CompressedImageCache &) = delete;
+
+    /// Memory allowed for compressed images, 1 GiB by default, least recently used ones get evicted
+    qint64 capacity() const;
+    void setCapacity(qint64 bytes);
+
+    /// Memory allowed for decompressed tiles, 64 MiB by default
+    qint64 hotCapacity() const;
+    void setHotCapacity(qint64 bytes);
+
+    /// Compress and store an image, replacing the one with the same key
+    bool insert(quint64 key, const QImage &image);
+    void remove(quint64 key);
+    void clear();
+
+    bool contains(quint64 key) const;
+    int count() const;
+    QList<quint64> keys() const;
+
+    /// Decompress a whole image, in its display format, null if not cached
+    QImage image(quint64 key) const;
+
+    CacheStats stats() const;
+    void resetStats();
+
+    /// Whether images are compressed with LZ4 rather than zlib
+    static bool isLz4Enabled();
+
+private:
+    friend class PixmapItem;
+    std::shared_ptr<detail::TileSource> source(quint64 key) const;
+
+private:
+    std::shared_ptr<detail::CompressedStore> m_store;
+};
+
+} // namespace pal
+
+#endif // PAL_COMPRESSED_IMAGE_CACHE_H
@@ -0,0 +1,143 @@
+#ifndef PAL_FRAME_RECORDER_H
+#define PAL_FRAME_RECORDER_H
+
+#include <deque>
+#include <memory>
+#include <QElapsedTimer>
+#include <QImage>
+#include <QObject>
+#include <pal/image-viewer-export.h>
+
+QT_BEGIN_NAMESPACE
+class QTimer;
+QT_END_NAMESPACE
+
+namespace pal {
+
+namespace detail {
+class SpillWriter;
+}
+
+/**
+ * @brief FrameRecorder keeps the last frames of a live feed, for replay
+ *
+ * The recorder sits between a frame source and the viewer. Live frames are
+ * passed on first and recorded afterwards, which only takes a reference to
+ * the image, so that the display path does not wait on recording:
+ *
+ *     connect(source, &Source::frameReady, &recorder, &FrameRecorder::record);
+ *     connect(&recorder, &FrameRecorder::frameReady, viewer, &ImageViewer::setImage);
+ *
+ * Frames are kept in memory for a bounded duration and amount of memory, and
+ * can be appended to a file by a background thread as well. While replaying,
+ * recorded frames are emitted at their original pace instead of live ones,
+ * which keep being recorded.
+ */
+class PAL_IMAGE_VIEWER_EXPORT FrameRecorder : public QObject {
+    Q_OBJECT
+
+public:
+    explicit FrameRecorder(QObject *parent = nullptr);
+    ~FrameRecorder() override;
+
+    /// Duration kept in memory in ms, 10 s by default
+    int duration() const;
+    void setDuration(int ms);
+
+    /// Memory allowed for recorded frames in bytes, 512 MiB by default
+    qint64 capacity() const;
+    void setCapacity(qint64 bytes);
+
+    /**
+     * Deep copy recorded frames, disabled by default. Needed for images
+     * wrapping memory that gets reused, such as SharedFrameSource frames.
+     */
+    bool isCopyingFrames() const;
+    void setCopyingFrames(bool on = true);
+
+    /// Recorded frames, oldest first
+    int frameCount() const;
+    QImage frame(int index) const;
+
+    /// Recording time of a frame in ns, relative to the first recorded frame
+    qint64 frameTime(int index) const;
+
+    /// Bytes held by the recorded frames
+    qint64 memoryUsage() const;
+
+    /// Drop the recorded frames
+    void clear();
+
+    /**
+     * Write recorded frames to a file from a background thread, replacing
+     * its content. Frames the writer cannot keep up with are dropped from the
+     * file only.
+     */
+    bool startSpill(const QString &path);
+    void stopSpill();
+    bool isSpilling() const;
+    quint64 spilledFrames() const;
+    quint64 spillDroppedFrames() const;
+
+    /**
+     * Replace the recorded frames with the last ones of a spill file. Live
+     * frames recorded afterwards are timed as following the loaded ones.
+     */
+    bool load(const QString &path);
+
+    QString errorString() const;
+
+    /// Replay state, index of the next frame to be replayed
+    bool isReplaying() const;
+    int replayPosition() const;
+
+public slots:
+    /// Record a live frame, passing it on unless replaying
+    void record(const QImage &frame);
+
+    /// Replay from a recorded frame at a speed factor, until the last one
+    void startReplay(int index = 0, double speed = 1.0);
+
+    /// Go back to live frames
+    void stopReplay();
+
+signals:
+    void frameReady(const QImage &frame);
+    void replayPositionChanged(int index);
+    void replayFinished();
+
+private slots:
+    void replayNext();
+
+private:
+    struct Frame {
+        QImage image;
+        qint64 time;  // ns
+    };
+
+    void append(QImage image, qint64 time);
+    void scheduleReplay();
+
+private:
+    std::deque<Frame> m_frames;
+    quint64 m_first;  // absolute number of the oldest frame
+    qint64 m_bytes;
+    qint64 m_capacity;
+    int m_duration;
+    bool m_copy;
+    QElapsedTimer m_clock;
+    QString m_error;
+    std::unique_ptr<detail::SpillWriter> m_spill;
+
+    QTimer *m_replay_timer;
+    bool m_replaying;
+    quint64 m_replay_next;    // absolute number of the next replayed frame
+    qint64 m_replay_origin_time;  // recording time of the first replayed frame
+    double m_replay_speed;
+    QElapsedTimer m_replay_clock;
+    qint64 m_time_offset;  // from m_clock to frame times, set by load()
+};
+
+} // namespace pal
+
+#endif // PAL_FRAME_RECORDER_H
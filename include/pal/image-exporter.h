@@ -0,0 +1,85 @@
+#ifndef PAL_IMAGE_EXPORTER_H
+#define PAL_IMAGE_EXPORTER_H
+
+#include <memory>
+#include <QImage>
+#include <QObject>
+#include <QRect>
+#include <pal/image-viewer-export.h>
+
+namespace pal {
+
+namespace detail {
+struct ExportJob;
+}
+
+/**
+ * Area of an image, clipped to it, as an image sharing its pixels. Creating
+ * the view is free whatever the size of the area, and the view keeps the
+ * pixels alive: writing to either image detaches it, leaving the other one
+ * untouched. Images of less than 8 bits per pixel are copied.
+ */
+PAL_IMAGE_VIEWER_EXPORT QImage imageView(const QImage &image, const QRect &rect);
+
+/**
+ * @brief ImageExporter saves images to files on a worker thread
+ *
+ * Saving only takes a reference to the image, which can be a view of a
+ * selection made with imageView(): encoding and writing happen on the global
+ * thread pool, and the outcome is signaled back to the exporter's thread.
+ * Files are written aside and only replace their destination once complete.
+ * One image is exported at a time.
+ */
+class PAL_IMAGE_VIEWER_EXPORT ImageExporter : public QObject {
+    Q_OBJECT
+
+public:
+    enum class Format {
+        Png,
+        Tiff,  ///< uncompressed
+        Raw    ///< lines of pixels in the image format, without padding nor header
+    };
+
+    explicit ImageExporter(QObject *parent = nullptr);
+    ~ImageExporter() override;
+
+    /// Format matching the suffix of a file name, PNG if unknown
+    static Format formatFor(const QString &path);
+
+    /**
+     * Start saving an image, returning right away. Returns false if the image
+     * is null or an export is running already.
+     */
+    bool save(const QImage &image, const QString &path, Format format);
+    bool save(const QImage &image, const QString &path);
+
+    /// Whether an export is running, until finished() is emitted
+    bool isBusy() const;
+
+    QString errorString() const;
+
+public slots:
+    /// Stop the running export, leaving its destination untouched
+    void cancel();
+
+signals:
+    /**
+     * Fraction of the export written, from 0 to 1. Raw and TIFF files report
+     * it as lines get written, PNG files as they start and end.
+     */
+    void progress(double done);
+
+    /// End of an export, cancelled or failed ones included
+    void finished(bool ok);
+
+private:
+    void done(bool ok, const QString &error);
+
+private:
+    std::shared_ptr<detail::ExportJob> m_job;
+    QString m_error;
+};
+
+} // namespace pal
+
+#endif // PAL_IMAGE_EXPORTER_H
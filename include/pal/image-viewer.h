@@ -1,19 +1,38 @@
 #ifndef PAL_IMAGE_VIEWER_H
 #define PAL_IMAGE_VIEWER_H
 
+#include <memory>
+#include <QColor>
+#include <QElapsedTimer>
 #include <QFrame>
 #include <QGraphicsPixmapItem>
+#include <QVector>
 #include <pal/image-viewer-export.h>
 
 QT_BEGIN_NAMESPACE
 class QGraphicsView;
 class QLabel;
+class QTimer;
+class QToolButton;
 QT_END_NAMESPACE
 
 namespace pal {
 
+class CompressedImageCache;
 class PixmapItem;
+class PyramidCache;
 class GraphicsView;
+class Loupe;
+class Overview;
+
+namespace detail {
+struct Fingerprints;
+class GLTileRenderer;
+class StatsCounters;
+struct RotatedTiles;
+struct SourceTiles;
+class TileSource;
+}
 
 // 5 -> 6 transition
 #if QT_VERSION_MAJOR > 5
@@ -23,6 +42,80 @@ using EnterEvent = QEvent;
 #endif
 
 
+/**
+ * @brief Render pipeline statistics, durations are in nanoseconds
+ */
+struct RenderStats {
+    qint64 conversionTime = 0;   ///< last image conversion to the display format
+    qint64 uploadTime = 0;       ///< last image to pixmap upload
+    qint64 paintTime = 0;        ///< last viewport paint
+    qint64 averagePaintTime = 0; ///< mean viewport paint
+    quint64 framesSubmitted = 0; ///< images set
+    quint64 framesPresented = 0; ///< images painted at least once
+    quint64 framesDropped = 0;   ///< images replaced before being painted
+    quint64 framesUnchanged = 0; ///< identical images skipped by fingerprinting
+    quint64 tilesUpdated = 0;    ///< tiles converted and repainted by fingerprinting
+    quint64 tilesUnchanged = 0;  ///< tiles left untouched by fingerprinting
+    qint64 memoryUsage = 0;      ///< bytes held by the image, its pixmap, tile caches and textures
+};
+
+
+/**
+ * @brief Layout of raw Bayer sensor images, named after their top left 2x2 cell
+ */
+enum class BayerPattern {
+    None,
+    RGGB,
+    BGGR,
+    GRBG,
+    GBRG
+};
+
+
+/**
+ * @brief A YUV frame, as produced by video decoders and cameras
+ *
+ * NV12 frames hold a Y plane and an interleaved UV plane, I420 ones Y, U and
+ * V planes, chroma being subsampled 2x2 in both. YUYV frames hold a single
+ * plane of packed 4:2:2 samples, and must have an even width. Planes are
+ * only read while the frame gets set.
+ */
+struct YuvFrame {
+    enum class Layout {
+        NV12,
+        I420,
+        YUYV
+    };
+
+    enum class ColorSpace {
+        BT601,
+        BT709
+    };
+
+    Layout layout = Layout::NV12;
+    ColorSpace colorSpace = ColorSpace::BT601;
+    bool fullRange = false;        ///< samples span 0-255 instead of 16-235
+    QSize size;
+    const uchar *planes[3] = {};
+    int strides[3] = {};           ///< bytes per line of each plane
+};
+
+
+/**
+ * @brief A single channel image of a composite, such as a fluorescence channel
+ *
+ * Samples are Grayscale8 or Grayscale16 values, mapped linearly from low
+ * (black) to high (full color).
+ */
+struct CompositeChannel {
+    QImage image;
+    QColor color = Qt::white;
+    int low = 0;
+    int high = 255;
+    bool visible = true;
+};
+
+
 /**
  * @brief ImageViewer displays images and allows basic interaction with it
  */
@@ -41,8 +134,17 @@ public:
         AutoHidden
     };
 
+    /**
+     * Viewport rendering backend
+     */
+    enum class Backend {
+        Raster,
+        OpenGL
+    };
+
 public:
     explicit ImageViewer(QWidget *parent = nullptr);
+    ~ImageViewer() override;
 
     /// Text displayed on the left side of the toolbar
     QString text() const;
@@ -65,7 +167,7 @@ public:
     bool isAntialiasingEnabled() const;
     void enableAntialiasing(bool on = true);
 
-    /// QGraphicsView control
+    /// QGraphicsView control, set up on first access or show
     QGraphicsView* view() const;
 
     /// Get view rotation angle
@@ -74,6 +176,69 @@ public:
     /// Get aspect ratio mode
     Qt::AspectRatioMode aspectRatioMode() const;
 
+    /**
+     * Viewport backend, Raster by default. The OpenGL backend uploads the
+     * image once as mipmapped texture tiles and lets the GPU transform them.
+     * Returns false and keeps the current backend if OpenGL is not usable.
+     */
+    Backend backend() const;
+    bool setBackend(Backend backend);
+
+    /// Render statistics collection, disabled by default
+    bool isStatsEnabled() const;
+    void setStatsEnabled(bool on = true);
+    RenderStats renderStats() const;
+    void resetStats();
+
+    /// Statistics overlay in the toolbar, showing it enables statistics
+    bool isStatsOverlayVisible() const;
+    void setStatsOverlayVisible(bool on = true);
+
+    /// Skip identical images and only repaint changed tiles, see PixmapItem
+    bool isFingerprintingEnabled() const;
+    void setFingerprintingEnabled(bool on = true);
+
+    /**
+     * Loupe, disabled by default and toggled from the toolbar. While the
+     * cursor hovers the image, a small window beside it shows the pixels
+     * around it magnified on a grid, with their values. It is rendered from
+     * the image data, the view is not repainted.
+     */
+    bool isLoupeEnabled() const;
+    void setLoupeEnabled(bool on = true);
+
+    /**
+     * Overview, disabled by default. While the view does not show the whole
+     * image, a thumbnail of it in the bottom right corner outlines the
+     * visible area, and clicking or dragging in it moves the view there. The
+     * thumbnail is sampled in the background once per image, the full image
+     * is never rescaled.
+     */
+    bool isOverviewEnabled() const;
+    void setOverviewEnabled(bool on = true);
+
+    /// Raw Bayer input, see PixmapItem
+    BayerPattern bayerPattern() const;
+    void setBayerPattern(BayerPattern pattern, int bits = 16);
+
+    /// Local contrast enhancement, see PixmapItem
+    bool isLocalContrastEnabled() const;
+    void setLocalContrastEnabled(bool on = true, int regions = 8, double clip_limit = 2.0);
+
+    /// Display a YUV frame, returns false if it is not valid, see PixmapItem
+    bool setYuvImage(const YuvFrame &frame);
+
+    /// Display an image of a compressed cache, see PixmapItem
+    bool setCachedImage(const CompressedImageCache &cache, quint64 key);
+
+    /// Display the cached pyramid of an image file, see PixmapItem
+    bool setPyramid(const PyramidCache &cache, const QString &path);
+
+    /// Multi-channel composite, see PixmapItem
+    bool setComposite(const QVector<CompositeChannel> &channels);
+    QVector<CompositeChannel> compositeChannels() const;
+    bool setCompositeChannel(int index, const CompositeChannel &channel);
+
 public slots:
     void setText(const QString &txt);
     void setImage(const QImage &);
@@ -92,10 +257,13 @@ public slots:
 
 private slots:
     void updateSceneRect(int w, int h);
+    void publishStats();
 
 signals:
     void imageChanged();
     void zoomChanged(double scale);
+    /// Emitted periodically while statistics are enabled
+    void statsUpdated(const pal::RenderStats &stats);
 
 protected:
     void enterEvent(EnterEvent *event) override;
@@ -107,18 +275,33 @@ private:
     qreal rotationRadians() const;
     qreal scale() const;
     void setMatrix();
+    void setupView();
     void makeToolbar();
+    void updateToolbarVisibility();
+    void updateOverview();
 
 private:
     int m_zoom_level;
+    QString m_text;
     QLabel *m_text_label;
     QLabel *m_pixel_value;
+    QLabel *m_stats_label;
     GraphicsView *m_view;
     PixmapItem *m_pixmap;
+    Loupe *m_loupe;
+    Overview *m_overview;
     QWidget *m_toolbar;
+    QToolButton *m_loupe_button;
+    QTimer *m_stats_timer;
+    QElapsedTimer m_stats_clock;
+    quint64 m_stats_presented;
+    qreal m_rotation;  // until the view gets created
     bool m_fit;
+    bool m_antialiasing;
+    bool m_stats_overlay;
     ToolBarMode m_bar_mode;
     Qt::AspectRatioMode m_aspect_ratio_mode;
+    Backend m_backend;
 };
 
 
@@ -127,8 +310,97 @@ class PAL_IMAGE_VIEWER_EXPORT PixmapItem : public QObject, public QGraphicsPixma
 
 public:
     PixmapItem(QGraphicsItem *parent = nullptr);
+    ~PixmapItem() override;
     const QImage & image() const { return m_image; }
 
+    /// Render statistics collection, disabled by default
+    bool isStatsEnabled() const;
+    void setStatsEnabled(bool on = true);
+    RenderStats renderStats() const;
+    void resetStats();
+
+    /**
+     * Frame fingerprinting, disabled by default. Incoming images get hashed
+     * tile by tile, identical images are skipped entirely and only the tiles
+     * that changed are converted and repainted, the image being painted from
+     * a display copy updated in place rather than from a pixmap. Meant for
+     * streams of mostly static frames.
+     */
+    bool isFingerprintingEnabled() const;
+    void setFingerprintingEnabled(bool on = true);
+
+    /**
+     * Raw Bayer input, None by default. Grayscale8 and Grayscale16 images are
+     * then taken as sensor mosaics and demosaiced when painted, for the
+     * visible tiles only and at the resolution they are seen at. Streams are
+     * interpolated bilinearly, images that stay put for a moment get a
+     * sharper, gradient corrected interpolation. Grayscale16 samples have
+     * bits significant bits, in the low bits.
+     */
+    BayerPattern bayerPattern() const;
+    void setBayerPattern(BayerPattern pattern, int bits = 16);
+
+    /**
+     * Local contrast enhancement (CLAHE), disabled by default. The image is
+     * split in regions x regions areas, each equalized after its luma
+     * histogram, clipped at clip_limit times its mean so as not to amplify
+     * noise, and pixels get the curves of the nearest areas interpolated.
+     * Histograms are computed in parallel for every image, the curves are
+     * applied when painting, to the visible tiles only and at the resolution
+     * they are seen at, then cached. Bayer and composite input is not
+     * enhanced.
+     */
+    bool isLocalContrastEnabled() const;
+    void setLocalContrastEnabled(bool on = true, int regions = 8, double clip_limit = 2.0);
+
+    /**
+     * Display a YUV frame. It is converted in bands of lines on the global
+     * thread pool, straight into the RGB32 image that becomes the pixmap,
+     * which image() returns. Returns false if the frame is not valid.
+     */
+    bool setYuvImage(const YuvFrame &frame);
+
+    /**
+     * Display a composite of 1 to 8 single channel images of the same size,
+     * blended additively with their color over their range. Channels keep
+     * their raw samples, the visible tiles are blended when painted and
+     * cached, so that changing a channel only renders what is on screen.
+     * image() is the first channel, setting an image ends the composite.
+     * Returns false if the channels cannot be composited together.
+     */
+    bool setComposite(const QVector<CompositeChannel> &channels);
+    QVector<CompositeChannel> compositeChannels() const;
+    bool setCompositeChannel(int index, const CompositeChannel &channel);
+
+    /**
+     * Display an image of a compressed cache. Only the tiles of the image
+     * that are visible get decompressed, when painted and on worker threads.
+     * image() is null meanwhile, pixels can be read with displayArea(). The
+     * image stays displayed if the cache evicts it. Returns false if the key
+     * is not cached.
+     */
+    bool setCachedImage(const CompressedImageCache &cache, quint64 key);
+
+    /**
+     * Display the pyramid of an image file from a pyramid cache, mapped in
+     * memory: the visible tiles are read from the mapping, at the level they
+     * are seen at, so that no level is built or loaded whole. image() is null
+     * meanwhile, as with cached images. Returns false if no valid pyramid of
+     * the current version of the file is cached.
+     */
+    bool setPyramid(const PyramidCache &cache, const QString &path);
+
+    /**
+     * Pixels of an area of the image as they are displayed, at full
+     * resolution and clipped to the image, rendered into a new image without
+     * painting the scene. Meant for small areas, such as the loupe's.
+     */
+    QImage displayArea(const QRect &rect) const;
+
+    QRectF boundingRect() const override;
+    QPainterPath shape() const override;
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) override;
+
 public slots:
     void setImage(QImage im);
 
@@ -145,9 +417,36 @@ protected:
     void hoverMoveEvent(QGraphicsSceneHoverEvent *) override;
 
 private:
+    bool updateImage(QImage im, qint64 conversion_ns = -1);
+    int updateYuvImage(const YuvFrame &frame);
+    int updateChangedTiles(const QImage &im);
+    void updateMemoryUsage();
+    void setSource(std::shared_ptr<detail::TileSource> source);
+    void showSource(std::shared_ptr<detail::TileSource> source);
+    QImage displayImage() const;
+    bool paintSource(QPainter *painter, const QStyleOptionGraphicsItem *option);
+    bool paintRotated(QPainter *painter, const QStyleOptionGraphicsItem *option);
+    bool paintOpenGL(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget);
+    bool paintDisplay(QPainter *painter);
+
+private:
+    friend class ImageViewer;
     QImage m_image;
+    std::unique_ptr<detail::StatsCounters> m_stats;
+    std::unique_ptr<detail::RotatedTiles> m_rotated;
+    std::unique_ptr<detail::GLTileRenderer> m_gl;
+    std::unique_ptr<detail::Fingerprints> m_fingerprints;
+    std::shared_ptr<detail::TileSource> m_source;
+    std::unique_ptr<detail::SourceTiles> m_source_tiles;
+    QVector<CompositeChannel> m_channels;
+    BayerPattern m_bayer;
+    int m_bayer_bits;
+    int m_clahe_regions;  // 0 when disabled
+    double m_clahe_clip;
 };
 
 } // namespace pal
 
+Q_DECLARE_METATYPE(pal::RenderStats)
+
 #endif // PAL_IMAGE_VIEWER_H
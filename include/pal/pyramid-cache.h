@@ -0,0 +1,78 @@
+#ifndef PAL_PYRAMID_CACHE_H
+#define PAL_PYRAMID_CACHE_H
+
+#include <memory>
+#include <mutex>
+#include <QImage>
+#include <QString>
+#include <pal/image-viewer-export.h>
+
+namespace pal {
+
+class PixmapItem;
+
+namespace detail {
+class TileSource;
+}
+
+/**
+ * @brief PyramidCache keeps the mip levels of huge images on disk, for instant reopening
+ *
+ * Every cached image is a file of the cache directory, holding its levels in
+ * 256x256 tiles, ready to display. Files are keyed by the path, modification
+ * time and size of the image file they were built from, so that a modified
+ * image misses. PixmapItem::setPyramid() maps the file in memory, and paints
+ * the tiles it shows straight from the mapping, at any zoom.
+ *
+ * The cache directory is bounded in size, the least recently opened files
+ * being removed. The cache is thread-safe, building a pyramid can happen on a
+ * worker thread.
+ */
+class PAL_IMAGE_VIEWER_EXPORT PyramidCache {
+public:
+    /// Cache in a directory, a subdirectory of the standard cache location if empty
+    explicit PyramidCache(const QString &directory = QString());
+    ~PyramidCache();
+
+    PyramidCache(const PyramidCache &) = delete;
+    PyramidCache& operator=(const PyramidCache &) = delete;
+
+    QString directory() const;
+
+    /// Disk space allowed for cached files, 4 GiB by default
+    qint64 capacity() const;
+    void setCapacity(qint64 bytes);
+
+    /// Bytes used by cached files
+    qint64 diskUsage() const;
+
+    /// Whether a pyramid of the current version of an image file is cached
+    bool contains(const QString &path) const;
+
+    /**
+     * Build and store the pyramid of an image file, of which image is the
+     * content. Returns false if the file cannot be written.
+     */
+    bool insert(const QString &path, const QImage &image);
+
+    void remove(const QString &path);
+    void clear();
+
+    QString errorString() const;
+
+private:
+    friend class PixmapItem;
+    std::shared_ptr<detail::TileSource> source(const QString &path) const;
+    QString cacheFile(const QString &path) const;
+    void evict(const QString &keep) const;
+
+private:
+    mutable std::mutex m_mutex;
+    QString m_directory;
+    qint64 m_capacity;
+    mutable QString m_error;
+};
+
+} // namespace pal
+
+#endif // PAL_PYRAMID_CACHE_H
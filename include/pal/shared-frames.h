@@ -0,0 +1,168 @@
+#ifndef PAL_SHARED_FRAMES_H
+#define PAL_SHARED_FRAMES_H
+
+#include <atomic>
+#include <cstdint>
+#include <QImage>
+#include <QObject>
+#include <pal/image-viewer-export.h>
+
+QT_BEGIN_NAMESPACE
+class QTimer;
+QT_END_NAMESPACE
+
+namespace pal {
+
+/**
+ * @brief Layout of the POSIX shared memory ring buffer streaming frames between processes
+ *
+ * The memory starts with a RingHeader, followed by slot_count slots made of a
+ * SlotHeader and slot_size bytes of pixel data, both at 64 bytes aligned
+ * offsets. There is a single producer and a single consumer.
+ *
+ * The producer writes a frame into a slot that is neither the latest one nor
+ * one held by the consumer, clearing its sequence number meanwhile, then
+ * publishes it by setting the slot sequence, RingHeader::latest and finally
+ * RingHeader::sequence. Frame sequence numbers start at 1.
+ *
+ * The consumer takes the latest slot by storing its index in
+ * RingHeader::reader, and keeps it until it takes another one. Before that,
+ * it moves the slot it held to RingHeader::previous, which it clears once the
+ * frame of that slot is released. It checks the slot sequence before and
+ * after taking it, the producer checks the reader and then the previous slot
+ * after clearing the sequence, so that one of them backs off on conflict.
+ */
+namespace shm {
+
+const uint32_t ring_magic = 0x52564950;  // "PIVR"
+const uint32_t ring_version = 2;
+const uint32_t no_slot = 0xffffffff;
+
+struct RingHeader {
+    uint32_t magic;                  ///< ring_magic, written last by the producer
+    uint32_t version;                ///< ring_version
+    uint32_t slot_count;             ///< at least 4
+    uint32_t slot_size;              ///< pixel data bytes per slot
+    std::atomic<uint64_t> sequence;  ///< last published frame, 0 if none
+    std::atomic<uint32_t> latest;    ///< slot of the last published frame
+    std::atomic<uint32_t> reader;    ///< slot held by the consumer, or no_slot
+    std::atomic<uint32_t> previous;  ///< slot replaced by the reader but still in use, or no_slot
+};
+
+struct SlotHeader {
+    std::atomic<uint64_t> sequence;  ///< frame held, 0 while being written
+    int64_t timestamp;               ///< steady clock time of publication, in ns
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;                 ///< bytes per line
+    uint32_t format;                 ///< QImage::Format value
+};
+
+} // namespace shm
+
+
+/**
+ * @brief SharedFrameWriter creates a frame ring buffer and publishes frames into it
+ */
+class PAL_IMAGE_VIEWER_EXPORT SharedFrameWriter {
+public:
+    SharedFrameWriter();
+    ~SharedFrameWriter();
+
+    SharedFrameWriter(const SharedFrameWriter &) = delete;
+    SharedFrameWriter& operator=(const SharedFrameWriter &) = delete;
+
+    /**
+     * Create the shared memory object name, replacing any stale one, with
+     * slot_count slots, at least 4, of slot_size bytes. Frames of up to
+     * slot_size bytes can be published.
+     */
+    bool create(const QString &name, int slot_count, qint64 slot_size);
+
+    /// Unmap and remove the shared memory object
+    void close();
+
+    bool isOpen() const;
+    QString errorString() const;
+
+    /// Copy a frame into a free slot and publish it, returns its sequence number or 0
+    quint64 publish(const QImage &image);
+
+private:
+    QString m_name;
+    QString m_error;
+    uchar *m_data;
+    size_t m_size;
+    quint32 m_next;
+    quint64 m_sequence;
+};
+
+
+/**
+ * @brief SharedFrameSource delivers the frames of a shared memory ring buffer
+ *
+ * The newest frame is polled periodically and delivered as a QImage pointing
+ * into the shared memory, without any copy:
+ *
+ *     connect(&source, &SharedFrameSource::frameReady, viewer, &ImageViewer::setImage);
+ *
+ * The slot of the last delivered frame is protected from the producer until
+ * the next frame gets delivered, and then until its image is released or yet
+ * another frame gets taken. Images must be copied to be kept longer, see
+ * FrameRecorder::setCopyingFrames().
+ * Frames published and replaced in between two polls are counted as overruns.
+ */
+class PAL_IMAGE_VIEWER_EXPORT SharedFrameSource : public QObject {
+    Q_OBJECT
+
+public:
+    explicit SharedFrameSource(QObject *parent = nullptr);
+    ~SharedFrameSource() override;
+
+    /// Attach to the ring buffer created by a producer, and start polling
+    bool open(const QString &name);
+    void close();
+
+    bool isOpen() const;
+    QString errorString() const;
+
+    /// Poll interval in ms, 2 by default, 0 to only poll by hand
+    int pollInterval() const;
+    void setPollInterval(int ms);
+
+    /// Sequence number of the last delivered frame
+    quint64 sequence() const;
+
+    /// Delivered frames
+    quint64 framesReceived() const;
+
+    /// Frames overwritten before they could be delivered
+    quint64 overruns() const;
+
+    /// Time elapsed between publication and delivery of the last frame, in ns
+    qint64 latency() const;
+
+public slots:
+    /// Deliver the newest frame if there is one, returns true if so
+    bool poll();
+
+signals:
+    void frameReady(const QImage &image);
+
+private:
+    struct Mapping;
+
+    QString m_error;
+    Mapping *m_map;
+    QTimer *m_timer;
+    int m_interval;
+    quint32 m_slot;
+    quint64 m_sequence;
+    quint64 m_received;
+    quint64 m_overruns;
+    qint64 m_latency;
+};
+
+} // namespace pal
+
+#endif // PAL_SHARED_FRAMES_H
@@ -0,0 +1,68 @@
+#ifndef PAL_VIEW_RENDERER_H
+#define PAL_VIEW_RENDERER_H
+
+#include <QBrush>
+#include <QColor>
+#include <QImage>
+#include <QPainterPath>
+#include <QPen>
+#include <QPointF>
+#include <QSize>
+#include <QVector>
+#include <pal/image-viewer.h>
+
+namespace pal {
+
+/**
+ * @brief A shape drawn over a rendered view, in image coordinates
+ *
+ * The text is drawn upright next to the top left corner of the shape,
+ * whatever the rotation. The default pen is cosmetic, one pixel wide at any
+ * zoom.
+ */
+struct ViewOverlay {
+    QPainterPath shape;
+    QPen pen = QPen(Qt::red, 0);
+    QBrush brush;
+    QString text;
+};
+
+
+/**
+ * @brief Settings of a view rendered without a viewer, mirroring ImageViewer's
+ */
+struct ViewParameters {
+    QSize size = QSize(640, 480);     ///< rendered image size
+    bool fit = true;                  ///< fit the image, as ImageViewer::zoomFit()
+    Qt::AspectRatioMode aspectRatioMode = Qt::KeepAspectRatio;  ///< how to fit
+    qreal zoom = 1.0;                 ///< scale factor, as reported by ImageViewer::zoomChanged(), when not fitting
+    qreal rotation = 0.;              ///< clockwise, in degrees
+    QPointF center;                   ///< image point at the center, the image center if null
+    QColor background = Qt::black;
+    bool antialiasing = false;        ///< for overlays, as ImageViewer::enableAntialiasing()
+    BayerPattern bayerPattern = BayerPattern::None;  ///< see PixmapItem::setBayerPattern()
+    int bayerBits = 16;
+    bool localContrast = false;       ///< see PixmapItem::setLocalContrastEnabled()
+    int localContrastRegions = 8;
+    double localContrastClipLimit = 2.0;
+    QVector<ViewOverlay> overlays;
+};
+
+
+/**
+ * Render a view of an image as ImageViewer would display it, without any
+ * widget, graphics view or GUI thread involved. Only the visible part of the
+ * image is read, one pixel out of two per halving of the zoom below 1:1.
+ *
+ * Rendering is thread-safe and meant to be run in parallel, as renderViews()
+ * does. Text overlays need a QGuiApplication instance, which can use the
+ * offscreen platform.
+ */
+PAL_IMAGE_VIEWER_EXPORT QImage renderView(const QImage &image, const ViewParameters &params);
+
+/// Render views of many images with the same settings, spread over the global thread pool
+PAL_IMAGE_VIEWER_EXPORT QVector<QImage> renderViews(const QVector<QImage> &images, const ViewParameters &params);
+
+} // namespace pal
+
+#endif // PAL_VIEW_RENDERER_H
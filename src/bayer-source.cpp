@@ -0,0 +1,71 @@
+#include <algorithm>
+#include "bayer-source.h"
+
+namespace pal {
+namespace detail {
+
+static kernels::Bayer kernelPattern(BayerPattern pattern) {
+    switch (pattern) {
+    case BayerPattern::BGGR: return kernels::Bayer::BGGR;
+    case BayerPattern::GRBG: return kernels::Bayer::GRBG;
+    case BayerPattern::GBRG: return kernels::Bayer::GBRG;
+    default:                 return kernels::Bayer::RGGB;
+    }
+}
+
+static bool isWide(const QImage &raw) {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 13, 0)
+    return raw.format() == QImage::Format_Grayscale16;
+#else
+    Q_UNUSED(raw)
+    return false;
+#endif
+}
+
+bool BayerSource::accepts(const QImage &raw) {
+    return !raw.isNull() && (raw.format() == QImage::Format_Grayscale8 || isWide(raw));
+}
+
+BayerSource::BayerSource(const QImage &raw, BayerPattern pattern, int bits)
+    : m_raw(raw)
+{
+    m_mosaic.data = m_raw.constBits();
+    m_mosaic.stride = m_raw.bytesPerLine();
+    m_mosaic.width = m_raw.width();
+    m_mosaic.height = m_raw.height();
+    m_mosaic.pattern = kernelPattern(pattern);
+    m_mosaic.wide = isWide(m_raw);
+    m_mosaic.shift = m_mosaic.wide ? std::max(0, std::min(bits, 16) - 8) : 0;
+}
+
+QSize BayerSource::size() const {
+    return m_raw.size();
+}
+
+bool BayerSource::hasRefinement() const {
+    return true;
+}
+
+int BayerSource::nativeLevels() const {
+    return 2;
+}
+
+QImage BayerSource::renderNative(const QRect &rect, int level, bool refined) const {
+    QImage image(rect.size(), QImage::Format_RGB32);
+    if (image.isNull())
+        return image;
+
+    if (level > 0)
+        kernels::demosaicHalf(m_mosaic, rect.x(), rect.y(), rect.width(), rect.height(),
+                              image.bits(), image.bytesPerLine());
+    else if (refined)
+        kernels::demosaicGradient(m_mosaic, rect.x(), rect.y(), rect.width(), rect.height(),
+                                  image.bits(), image.bytesPerLine());
+    else
+        kernels::demosaicBilinear(m_mosaic, rect.x(), rect.y(), rect.width(), rect.height(),
+                                  image.bits(), image.bytesPerLine());
+    return image;
+}
+
+} // namespace detail
+} // namespace pal
@@ -0,0 +1,38 @@
+#pragma once
+#include <QImage>
+#include "kernels.h"
+#include "pal/image-viewer.h"
+#include "tile-source.h"
+
+namespace pal {
+namespace detail {
+
+/**
+ * Demosaics a raw Bayer image held in a Grayscale8 or Grayscale16 QImage.
+ *
+ * Full resolution areas are interpolated bilinearly, or with gradient
+ * correction when refined. Level 1 takes one pixel per 2x2 cell, which is
+ * both cheaper and sharper than downscaling interpolated pixels.
+ */
+class BayerSource : public TileSource {
+public:
+    /// Whether an image can be taken as a Bayer mosaic
+    static bool accepts(const QImage &raw);
+
+    /// 16 bits samples are scaled from their significant bits to 8 bits
+    BayerSource(const QImage &raw, BayerPattern pattern, int bits);
+
+    QSize size() const override;
+    bool hasRefinement() const override;
+
+protected:
+    int nativeLevels() const override;
+    QImage renderNative(const QRect &rect, int level, bool refined) const override;
+
+private:
+    QImage m_raw;
+    kernels::BayerMosaic m_mosaic;
+};
+
+} // namespace detail
+} // namespace pal
@@ -0,0 +1,61 @@
+#include <algorithm>
+#include "clahe-source.h"
+#include "kernels.h"
+#include "parallel.h"
+
+namespace pal {
+namespace detail {
+
+// histograms are built from at most about that many pixels per side
+static const int histogram_side = 2048;
+
+// The kernels read 32 bits pixels with premultiplied alpha
+static QImage toClaheInput(const QImage &image) {
+    if (image.format() == QImage::Format_RGB32 || image.format() == QImage::Format_ARGB32_Premultiplied)
+        return image;
+    return image.convertToFormat(image.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied
+                                                         : QImage::Format_RGB32);
+}
+
+ClaheSource::ClaheSource(const QImage &image, int regions, double clip_limit)
+    : m_image(toClaheInput(image))
+    , m_regions(std::max(1, std::min(regions, std::min(image.width(), image.height()))))
+    , m_tables(size_t(m_regions * m_regions) * 256)
+{
+    if (m_image.isNull())
+        return;
+
+    const int step = std::max(1, std::max(m_image.width(), m_image.height()) / histogram_side);
+    const uchar *bits = m_image.constBits();
+    const ptrdiff_t stride = m_image.bytesPerLine();
+
+    parallelFor(m_regions * m_regions, [&](int i) {
+        kernels::claheTable(bits, stride, m_image.width(), m_image.height(), m_regions,
+                            i % m_regions, i / m_regions, clip_limit, step, &m_tables[size_t(i) * 256]);
+    });
+}
+
+QSize ClaheSource::size() const {
+    return m_image.size();
+}
+
+int ClaheSource::nativeLevels() const {
+    return 32;
+}
+
+QImage ClaheSource::renderNative(const QRect &rect, int level, bool refined) const {
+    Q_UNUSED(refined)
+
+    QImage image(rect.size(), m_image.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied
+                                                        : QImage::Format_RGB32);
+    if (image.isNull() || m_image.isNull())
+        return image;
+
+    kernels::claheApply(m_image.constBits(), m_image.bytesPerLine(), m_image.width(), m_image.height(),
+                        m_regions, m_tables.data(), rect.x(), rect.y(), rect.width(), rect.height(),
+                        1 << level, image.bits(), image.bytesPerLine());
+    return image;
+}
+
+} // namespace detail
+} // namespace pal
@@ -0,0 +1,34 @@
+#pragma once
+#include <vector>
+#include <QImage>
+#include "tile-source.h"
+
+namespace pal {
+namespace detail {
+
+/**
+ * Contrast limited adaptive histogram equalization of an image. Images that
+ * are not RGB32 or ARGB32_Premultiplied get converted to one of them.
+ *
+ * The equalization tables of all the areas are computed in parallel up
+ * front, from a subsample of huge images. Pixels are only mapped when their
+ * tile gets rendered, every level natively from the full resolution image.
+ */
+class ClaheSource : public TileSource {
+public:
+    ClaheSource(const QImage &image, int regions, double clip_limit);
+
+    QSize size() const override;
+
+protected:
+    int nativeLevels() const override;
+    QImage renderNative(const QRect &rect, int level, bool refined) const override;
+
+private:
+    QImage m_image;
+    int m_regions;
+    std::vector<uint8_t> m_tables;
+};
+
+} // namespace detail
+} // namespace pal
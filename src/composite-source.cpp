@@ -0,0 +1,75 @@
+#include <algorithm>
+#include "composite-source.h"
+
+namespace pal {
+namespace detail {
+
+static bool isWide(const QImage &image) {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 13, 0)
+    return image.format() == QImage::Format_Grayscale16;
+#else
+    Q_UNUSED(image)
+    return false;
+#endif
+}
+
+bool CompositeSource::accepts(const QVector<CompositeChannel> &channels) {
+    if (channels.isEmpty() || channels.size() > max_channels)
+        return false;
+
+    const QSize size = channels.first().image.size();
+    for (const CompositeChannel &c : channels) {
+        const QImage &im = c.image;
+        if (im.isNull() || im.size() != size || (im.format() != QImage::Format_Grayscale8 && !isWide(im)))
+            return false;
+    }
+    return true;
+}
+
+CompositeSource::CompositeSource(const QVector<CompositeChannel> &channels)
+    : m_size(channels.isEmpty() ? QSize() : channels.first().image.size())
+{
+    for (const CompositeChannel &c : channels) {
+        if (!c.visible)
+            continue;
+
+        // keeps the samples alive as long as the source
+        m_images.append(c.image);
+
+        const int max = isWide(c.image) ? 0xffff : 0xff;
+        const QColor rgb = c.color.toRgb();
+        kernels::CompositeLayer layer;
+        layer.data = c.image.constBits();
+        layer.stride = c.image.bytesPerLine();
+        layer.wide = isWide(c.image);
+        layer.low = uint16_t(std::max(0, std::min(c.low, max)));
+        layer.high = uint16_t(std::max(0, std::min(c.high, max)));
+        layer.color[0] = uint8_t(rgb.red());
+        layer.color[1] = uint8_t(rgb.green());
+        layer.color[2] = uint8_t(rgb.blue());
+        m_layers.push_back(layer);
+    }
+}
+
+QSize CompositeSource::size() const {
+    return m_size;
+}
+
+int CompositeSource::nativeLevels() const {
+    return 32;
+}
+
+QImage CompositeSource::renderNative(const QRect &rect, int level, bool refined) const {
+    Q_UNUSED(refined)
+
+    QImage image(rect.size(), QImage::Format_RGB32);
+    if (image.isNull())
+        return image;
+
+    kernels::compositeToXrgb(m_layers.data(), int(m_layers.size()), rect.x(), rect.y(),
+                             rect.width(), rect.height(), 1 << level, image.bits(), image.bytesPerLine());
+    return image;
+}
+
+} // namespace detail
+} // namespace pal
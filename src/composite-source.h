@@ -0,0 +1,39 @@
+#pragma once
+#include <vector>
+#include <QVector>
+#include "kernels.h"
+#include "pal/image-viewer.h"
+#include "tile-source.h"
+
+namespace pal {
+namespace detail {
+
+/**
+ * Blends the visible channels of a composite additively.
+ *
+ * Every level is rendered natively, taking one sample out of 2^level, so
+ * that zoomed out views of huge channels only read what they show.
+ */
+class CompositeSource : public TileSource {
+public:
+    static const int max_channels = 8;
+
+    /// Whether channels can be composited together
+    static bool accepts(const QVector<CompositeChannel> &channels);
+
+    explicit CompositeSource(const QVector<CompositeChannel> &channels);
+
+    QSize size() const override;
+
+protected:
+    int nativeLevels() const override;
+    QImage renderNative(const QRect &rect, int level, bool refined) const override;
+
+private:
+    QSize m_size;
+    QVector<QImage> m_images;
+    std::vector<kernels::CompositeLayer> m_layers;
+};
+
+} // namespace detail
+} // namespace pal
@@ -0,0 +1,386 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <QCache>
+#include <QElapsedTimer>
+#include <QHash>
+#include "pal/compressed-image-cache.h"
+#include "parallel.h"
+#include "tile-source.h"
+
+#if PAL_IMAGE_VIEWER_LZ4
+#include <lz4.h>
+#endif
+
+namespace pal {
+namespace detail {
+
+static QByteArray compress(const char *data, int size) {
+#if PAL_IMAGE_VIEWER_LZ4
+    QByteArray packed(LZ4_compressBound(size), Qt::Uninitialized);
+    packed.resize(LZ4_compress_default(data, packed.data(), size, int(packed.size())));
+    return packed;
+#else
+    return qCompress(reinterpret_cast<const uchar*>(data), size, 1);
+#endif
+}
+
+static bool decompress(const QByteArray &packed, char *data, int size) {
+#if PAL_IMAGE_VIEWER_LZ4
+    return LZ4_decompress_safe(packed.constData(), data, int(packed.size()), size) == size;
+#else
+    const QByteArray raw = qUncompress(packed);
+    if (raw.size() != size)
+        return false;
+    std::memcpy(data, raw.constData(), size_t(size));
+    return true;
+#endif
+}
+
+/*
+ * An image stored as compressed tiles, in its own format when it has at
+ * least a byte per pixel. Immutable once built, shared with the sources
+ * displaying it.
+ */
+struct CompressedImage {
+    static const int tile_size = 256;
+
+    QRect tileRect(int index) const {
+        const int tx = index % columns;
+        const int ty = index / columns;
+        return QRect(tx * tile_size, ty * tile_size, tile_size, tile_size) & QRect(QPoint(), size);
+    }
+
+    QImage::Format displayFormat() const {
+        return alpha ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32;
+    }
+
+    // a tile in the display format
+    QImage tile(int index) const {
+        const QRect r = tileRect(index);
+        const int bpl = r.width() * bytes_per_pixel;
+        QByteArray raw(bpl * r.height(), Qt::Uninitialized);
+        if (!decompress(tiles[size_t(index)], raw.data(), int(raw.size())))
+            return QImage();
+
+        QImage wrapped(reinterpret_cast<const uchar*>(raw.constData()), r.width(), r.height(), bpl, format);
+        if (!colors.isEmpty())
+            wrapped.setColorTable(colors);
+        // conversions to the same format share the data, which goes away
+        return format == displayFormat() ? wrapped.copy() : wrapped.convertToFormat(displayFormat());
+    }
+
+    quint64 id;
+    QSize size;
+    QImage::Format format;
+    QVector<QRgb> colors;
+    bool alpha;
+    int bytes_per_pixel;
+    int columns;
+    int rows;
+    std::vector<QByteArray> tiles;
+    qint64 raw_bytes;
+    qint64 compressed_bytes;
+};
+
+class CompressedStore {
+public:
+    CompressedStore()
+        : next_id(1)
+        , next_use(0)
+        , capacity(qint64(1024) * 1024 * 1024)
+        , compressed_bytes(0)
+        , hot(64 * 1024)  // KiB
+        , tiles_decompressed(0)
+        , hot_hits(0)
+        , decompression_ns(0)
+    {}
+
+    struct Entry {
+        std::shared_ptr<const CompressedImage> image;
+        quint64 last_use;
+    };
+
+    // a tile from the hot cache, decompressed there if missing
+    QImage tile(const CompressedImage &image, int index) {
+        const quint64 key = (image.id << 24) | quint64(index);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (const QImage *t = hot.object(key)) {
+                hot_hits.fetch_add(1, std::memory_order_relaxed);
+                return *t;
+            }
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+        const QImage t = image.tile(index);
+        decompression_ns.fetch_add(timer.nsecsElapsed(), std::memory_order_relaxed);
+        tiles_decompressed.fetch_add(1, std::memory_order_relaxed);
+        // failures are not cached, the next paint tries again
+        if (t.isNull())
+            return t;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        hot.insert(key, new QImage(t), std::max(1, int(qint64(t.bytesPerLine()) * t.height() / 1024)));
+        return t;
+    }
+
+    // mark an entry as the most recently used one
+    void touch(quint64 key, Entry &entry) {
+        lru.erase(entry.last_use);
+        entry.last_use = next_use++;
+        lru.emplace(entry.last_use, key);
+    }
+
+    void erase(QHash<quint64, Entry>::iterator it) {
+        compressed_bytes -= it->image->compressed_bytes;
+        lru.erase(it->last_use);
+        entries.erase(it);
+    }
+
+    // drop least recently used images until within capacity, keeping the newest
+    void evict() {
+        while (compressed_bytes > capacity && entries.size() > 1)
+            erase(entries.find(lru.begin()->second));
+    }
+
+    std::mutex mutex;  // everything but the counters
+    QHash<quint64, Entry> entries;
+    std::map<quint64, quint64> lru;  // last use to key, oldest first
+    quint64 next_id;
+    quint64 next_use;
+    qint64 capacity;
+    qint64 compressed_bytes;
+    QCache<quint64, QImage> hot;
+
+    std::atomic<quint64> tiles_decompressed;
+    std::atomic<quint64> hot_hits;
+    std::atomic<qint64> decompression_ns;
+};
+
+/*
+ * Displays a compressed image, every level rendered natively by taking one
+ * pixel out of 2^level from the tiles it falls in.
+ */
+class CompressedSource : public TileSource {
+public:
+    CompressedSource(std::shared_ptr<CompressedStore> store, std::shared_ptr<const CompressedImage> image)
+        : m_store(std::move(store))
+        , m_image(std::move(image))
+    {}
+
+    QSize size() const override {
+        return m_image->size;
+    }
+
+protected:
+    int nativeLevels() const override {
+        return 32;
+    }
+
+    QImage renderNative(const QRect &rect, int level, bool refined) const override {
+        Q_UNUSED(refined)
+
+        QImage out(rect.size(), m_image->displayFormat());
+        if (out.isNull())
+            return out;
+        const QRgb blank = m_image->alpha ? 0 : qRgb(0, 0, 0);
+
+        const int ts = CompressedImage::tile_size;
+        const int step = 1 << level;
+        const int x0 = rect.x() * step;
+        const int y0 = rect.y() * step;
+        const int last_tx = std::min(m_image->columns - 1, (x0 + (rect.width() - 1) * step) / ts);
+        const int last_ty = std::min(m_image->rows - 1, (y0 + (rect.height() - 1) * step) / ts);
+
+        for (int ty = y0 / ts; ty <= last_ty; ++ty) {
+            for (int tx = x0 / ts; tx <= last_tx; ++tx) {
+                // output pixels whose sample falls in the tile
+                const int index = ty * m_image->columns + tx;
+                const QRect r = m_image->tileRect(index);
+                const int i0 = std::max(0, (r.x() - x0 + step - 1) / step);
+                const int i1 = std::min(rect.width(), (r.x() + r.width() - x0 + step - 1) / step);
+                const int j0 = std::max(0, (r.y() - y0 + step - 1) / step);
+                const int j1 = std::min(rect.height(), (r.y() + r.height() - y0 + step - 1) / step);
+
+                const QImage tile = m_store->tile(*m_image, index);
+                if (tile.isNull()) {
+                    for (int j = j0; j < j1; ++j)
+                        std::fill_n(reinterpret_cast<QRgb*>(out.scanLine(j)) + i0, std::max(0, i1 - i0), blank);
+                    continue;
+                }
+
+                for (int j = j0; j < j1; ++j) {
+                    const QRgb *src = reinterpret_cast<const QRgb*>(tile.constScanLine(y0 + j * step - r.y()));
+                    QRgb *dst = reinterpret_cast<QRgb*>(out.scanLine(j));
+                    for (int i = i0; i < i1; ++i)
+                        dst[i] = src[x0 + i * step - r.x()];
+                }
+            }
+        }
+        return out;
+    }
+
+private:
+    std::shared_ptr<CompressedStore> m_store;
+    std::shared_ptr<const CompressedImage> m_image;
+};
+
+} // namespace detail
+
+
+CompressedImageCache::CompressedImageCache()
+    : m_store(std::make_shared<detail::CompressedStore>())
+{}
+
+CompressedImageCache::~CompressedImageCache() = default;
+
+qint64 CompressedImageCache::capacity() const {
+    std::lock_guard<std::mutex> lock(m_store->mutex);
+    return m_store->capacity;
+}
+
+void CompressedImageCache::setCapacity(qint64 bytes) {
+    std::lock_guard<std::mutex> lock(m_store->mutex);
+    m_store->capacity = bytes;
+    m_store->evict();
+}
+
+qint64 CompressedImageCache::hotCapacity() const {
+    std::lock_guard<std::mutex> lock(m_store->mutex);
+    return qint64(m_store->hot.maxCost()) * 1024;
+}
+
+void CompressedImageCache::setHotCapacity(qint64 bytes) {
+    std::lock_guard<std::mutex> lock(m_store->mutex);
+    m_store->hot.setMaxCost(int(std::max(qint64(1), bytes / 1024)));
+}
+
+bool CompressedImageCache::insert(quint64 key, const QImage &image) {
+    if (image.isNull())
+        return false;
+
+    // formats with less than a byte per pixel are tiled as 8 bits indices
+    const QImage im = image.depth() < 8 ? image.convertToFormat(QImage::Format_Indexed8) : image;
+
+    auto c = std::make_shared<detail::CompressedImage>();
+    const int ts = detail::CompressedImage::tile_size;
+    c->size = im.size();
+    c->format = im.format();
+    c->colors = im.colorTable();
+    c->alpha = im.hasAlphaChannel();
+    c->bytes_per_pixel = im.depth() / 8;
+    c->columns = (im.width() + ts - 1) / ts;
+    c->rows = (im.height() + ts - 1) / ts;
+    c->tiles.resize(size_t(c->columns) * size_t(c->rows));
+    c->raw_bytes = qint64(im.bytesPerLine()) * im.height();
+
+    detail::parallelFor(int(c->tiles.size()), [&](int i) {
+        const QRect r = c->tileRect(i);
+        const int bpl = r.width() * c->bytes_per_pixel;
+        std::vector<char> raw(size_t(bpl) * size_t(r.height()));
+        for (int y = 0; y < r.height(); ++y)
+            std::memcpy(raw.data() + y * bpl, im.constScanLine(r.y() + y) + r.x() * c->bytes_per_pixel, size_t(bpl));
+        c->tiles[size_t(i)] = detail::compress(raw.data(), int(raw.size()));
+    });
+
+    c->compressed_bytes = 0;
+    for (const QByteArray &t : c->tiles)
+        c->compressed_bytes += t.size();
+
+    std::lock_guard<std::mutex> lock(m_store->mutex);
+    c->id = m_store->next_id++;
+    auto it = m_store->entries.find(key);
+    if (it != m_store->entries.end())
+        m_store->erase(it);
+    m_store->compressed_bytes += c->compressed_bytes;
+    m_store->lru.emplace(m_store->next_use, key);
+    m_store->entries.insert(key, {std::move(c), m_store->next_use++});
+    m_store->evict();
+    return true;
+}
+
+void CompressedImageCache::remove(quint64 key) {
+    std::lock_guard<std::mutex> lock(m_store->mutex);
+    auto it = m_store->entries.find(key);
+    if (it == m_store->entries.end())
+        return;
+    m_store->erase(it);
+}
+
+void CompressedImageCache::clear() {
+    std::lock_guard<std::mutex> lock(m_store->mutex);
+    m_store->entries.clear();
+    m_store->lru.clear();
+    m_store->compressed_bytes = 0;
+    m_store->hot.clear();
+}
+
+bool CompressedImageCache::contains(quint64 key) const {
+    std::lock_guard<std::mutex> lock(m_store->mutex);
+    return m_store->entries.contains(key);
+}
+
+int CompressedImageCache::count() const {
+    std::lock_guard<std::mutex> lock(m_store->mutex);
+    return int(m_store->entries.size());
+}
+
+QList<quint64> CompressedImageCache::keys() const {
+    std::lock_guard<std::mutex> lock(m_store->mutex);
+    return m_store->entries.keys();
+}
+
+QImage CompressedImageCache::image(quint64 key) const {
+    std::shared_ptr<detail::TileSource> s = source(key);
+    return s ? s->render(QRect(QPoint(), s->size()), 0, false) : QImage();
+}
+
+std::shared_ptr<detail::TileSource> CompressedImageCache::source(quint64 key) const {
+    std::lock_guard<std::mutex> lock(m_store->mutex);
+    auto it = m_store->entries.find(key);
+    if (it == m_store->entries.end())
+        return nullptr;
+    m_store->touch(key, *it);
+    return std::make_shared<detail::CompressedSource>(m_store, it->image);
+}
+
+CacheStats CompressedImageCache::stats() const {
+    CacheStats s;
+    {
+        std::lock_guard<std::mutex> lock(m_store->mutex);
+        s.images = int(m_store->entries.size());
+        for (const auto &e : m_store->entries)
+            s.rawBytes += e.image->raw_bytes;
+        s.compressedBytes = m_store->compressed_bytes;
+        s.hotBytes = qint64(m_store->hot.totalCost()) * 1024;
+    }
+    if (s.compressedBytes > 0)
+        s.compressionRatio = double(s.rawBytes) / double(s.compressedBytes);
+    s.tilesDecompressed = m_store->tiles_decompressed.load(std::memory_order_relaxed);
+    s.hotHits = m_store->hot_hits.load(std::memory_order_relaxed);
+    s.decompressionTime = m_store->decompression_ns.load(std::memory_order_relaxed);
+    if (s.tilesDecompressed > 0)
+        s.averageDecompressionTime = s.decompressionTime / qint64(s.tilesDecompressed);
+    return s;
+}
+
+void CompressedImageCache::resetStats() {
+    m_store->tiles_decompressed = 0;
+    m_store->hot_hits = 0;
+    m_store->decompression_ns = 0;
+}
+
+bool CompressedImageCache::isLz4Enabled() {
+#if PAL_IMAGE_VIEWER_LZ4
+    return true;
+#else
+    return false;
+#endif
+}
+
+} // namespace pal
@@ -0,0 +1,448 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <QFile>
+#include <QTimer>
+#include "pal/frame-recorder.h"
+
+namespace pal {
+
+namespace detail {
+
+static qint64 imageBytes(const QImage &image) {
+    return qint64(image.bytesPerLine()) * image.height();
+}
+
+/*
+ * Spill file layout, in native byte order: a file header followed by one
+ * record per frame, made of a record header, the color table and the pixels.
+ */
+const char spill_magic[8] = {'P', 'I', 'V', 'R', 'E', 'C', '0', '1'};
+const quint32 record_magic = 0x46564950;  // "PIVF"
+
+struct RecordHeader {
+    quint32 magic;
+    quint32 format;       // QImage::Format
+    qint64 time;          // ns
+    quint32 width;
+    quint32 height;
+    quint32 stride;
+    quint32 color_count;
+};
+
+// Lines are stored without padding. Images wrapping memory, such as views of
+// a larger image, may have a stride that runs past their last pixel.
+static bool writeRecord(QFile &file, const QImage &image, qint64 time) {
+    const qint64 line = (qint64(image.width()) * image.depth() + 7) / 8;
+    RecordHeader h;
+    h.magic = record_magic;
+    h.format = quint32(image.format());
+    h.time = time;
+    h.width = quint32(image.width());
+    h.height = quint32(image.height());
+    h.stride = quint32(line);
+    h.color_count = quint32(image.colorCount());
+
+    const QVector<QRgb> colors = image.colorTable();
+    const qint64 colors_size = qint64(colors.size()) * qint64(sizeof(QRgb));
+
+    bool ok = file.write(reinterpret_cast<const char*>(&h), sizeof(h)) == qint64(sizeof(h))
+           && file.write(reinterpret_cast<const char*>(colors.constData()), colors_size) == colors_size;
+    for (int y = 0; ok && y < image.height(); ++y)
+        ok = file.write(reinterpret_cast<const char*>(image.constScanLine(y)), line) == line;
+    return ok;
+}
+
+static bool readRecord(QFile &file, QImage &image, qint64 &time) {
+    RecordHeader h;
+    if (file.read(reinterpret_cast<char*>(&h), sizeof(h)) != qint64(sizeof(h)) || h.magic != record_magic
+        || h.format == 0 || h.format >= quint32(QImage::NImageFormats) || h.color_count > 256)
+        return false;
+
+    // the record must fit in the rest of the file, before allocating anything
+    const qint64 colors_size = qint64(h.color_count) * qint64(sizeof(QRgb));
+    if (h.width > quint32(std::numeric_limits<int>::max()) || h.height > quint32(std::numeric_limits<int>::max())
+        || h.stride > quint32(std::numeric_limits<int>::max())
+        || colors_size + qint64(h.stride) * h.height > file.size() - file.pos())
+        return false;
+
+    QImage im(int(h.width), int(h.height), QImage::Format(h.format));
+    if (im.isNull() || qint64(h.stride) * 8 < qint64(h.width) * im.depth())
+        return false;
+
+    QVector<QRgb> colors(int(h.color_count));
+    if (file.read(reinterpret_cast<char*>(colors.data()), colors_size) != colors_size)
+        return false;
+    if (!colors.isEmpty())
+        im.setColorTable(colors);
+
+    // lines are stored with the stride of the recorded image, which may be
+    // padded differently
+    const qint64 bpl = im.bytesPerLine();
+    QByteArray line(int(h.stride), Qt::Uninitialized);
+    for (int y = 0; y < im.height(); ++y) {
+        char *dst = reinterpret_cast<char*>(im.scanLine(y));
+        if (h.stride == bpl) {
+            if (file.read(dst, bpl) != bpl)
+                return false;
+        }
+        else {
+            if (file.read(line.data(), line.size()) != line.size())
+                return false;
+            std::memcpy(dst, line.constData(), size_t(std::min(bpl, qint64(h.stride))));
+        }
+    }
+
+    image = std::move(im);
+    time = h.time;
+    return true;
+}
+
+/*
+ * Appends frames to the spill file from its own thread. The queue is bounded,
+ * a live feed never waits for the disk.
+ */
+class SpillWriter {
+public:
+    static const qint64 max_queued = 256 * 1024 * 1024;
+
+    explicit SpillWriter(const QString &path)
+        : m_file(path)
+        , m_queued(0)
+        , m_stop(false)
+        , m_written(0)
+        , m_dropped(0)
+    {}
+
+    ~SpillWriter() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cond.notify_one();
+        if (m_thread.joinable())
+            m_thread.join();
+    }
+
+    bool start() {
+        // one recording per file, their times would not follow each other
+        if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+            return false;
+        if (m_file.write(spill_magic, sizeof(spill_magic)) != qint64(sizeof(spill_magic)))
+            return false;
+        m_thread = std::thread([this] { run(); });
+        return true;
+    }
+
+    QString errorString() const {
+        return m_file.errorString();
+    }
+
+    void push(const QImage &image, qint64 time) {
+        const qint64 bytes = imageBytes(image);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_queued + bytes > max_queued) {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            m_queue.push_back({image, time});
+            m_queued += bytes;
+        }
+        m_cond.notify_one();
+    }
+
+    quint64 written() const {
+        return m_written.load(std::memory_order_relaxed);
+    }
+
+    quint64 dropped() const {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Item {
+        QImage image;
+        qint64 time;
+    };
+
+    void run() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (;;) {
+            m_cond.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+            if (m_queue.empty())
+                break;
+
+            Item item = std::move(m_queue.front());
+            m_queue.pop_front();
+
+            lock.unlock();
+            const bool ok = writeRecord(m_file, item.image, item.time);
+            lock.lock();
+
+            m_queued -= imageBytes(item.image);
+            if (ok)
+                m_written.fetch_add(1, std::memory_order_relaxed);
+            else
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+        m_file.flush();
+    }
+
+private:
+    QFile m_file;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::deque<Item> m_queue;
+    qint64 m_queued;
+    bool m_stop;
+    std::atomic<quint64> m_written;
+    std::atomic<quint64> m_dropped;
+};
+
+} // namespace detail
+
+
+FrameRecorder::FrameRecorder(QObject *parent)
+    : QObject(parent)
+    , m_first(0)
+    , m_bytes(0)
+    , m_capacity(qint64(512) * 1024 * 1024)
+    , m_duration(10000)
+    , m_copy(false)
+    , m_replay_timer(new QTimer(this))
+    , m_replaying(false)
+    , m_replay_next(0)
+    , m_replay_origin_time(0)
+    , m_replay_speed(1.0)
+    , m_time_offset(0)
+{
+    m_clock.start();
+    m_replay_timer->setSingleShot(true);
+    m_replay_timer->setTimerType(Qt::PreciseTimer);
+    connect(m_replay_timer, &QTimer::timeout, this, &FrameRecorder::replayNext);
+}
+
+FrameRecorder::~FrameRecorder() = default;
+
+int FrameRecorder::duration() const {
+    return m_duration;
+}
+
+void FrameRecorder::setDuration(int ms) {
+    m_duration = ms;
+}
+
+qint64 FrameRecorder::capacity() const {
+    return m_capacity;
+}
+
+void FrameRecorder::setCapacity(qint64 bytes) {
+    m_capacity = bytes;
+}
+
+bool FrameRecorder::isCopyingFrames() const {
+    return m_copy;
+}
+
+void FrameRecorder::setCopyingFrames(bool on) {
+    m_copy = on;
+}
+
+int FrameRecorder::frameCount() const {
+    return int(m_frames.size());
+}
+
+QImage FrameRecorder::frame(int index) const {
+    if (index < 0 || index >= frameCount())
+        return QImage();
+    return m_frames[size_t(index)].image;
+}
+
+qint64 FrameRecorder::frameTime(int index) const {
+    if (index < 0 || index >= frameCount())
+        return 0;
+    return m_frames[size_t(index)].time - m_frames.front().time;
+}
+
+qint64 FrameRecorder::memoryUsage() const {
+    return m_bytes;
+}
+
+void FrameRecorder::clear() {
+    stopReplay();
+    m_first += m_frames.size();
+    m_frames.clear();
+    m_bytes = 0;
+    m_time_offset = 0;
+}
+
+bool FrameRecorder::startSpill(const QString &path) {
+    stopSpill();
+
+    std::unique_ptr<detail::SpillWriter> spill(new detail::SpillWriter(path));
+    if (!spill->start()) {
+        m_error = spill->errorString();
+        return false;
+    }
+    m_spill = std::move(spill);
+    return true;
+}
+
+void FrameRecorder::stopSpill() {
+    m_spill.reset();
+}
+
+bool FrameRecorder::isSpilling() const {
+    return m_spill != nullptr;
+}
+
+quint64 FrameRecorder::spilledFrames() const {
+    return m_spill ? m_spill->written() : 0;
+}
+
+quint64 FrameRecorder::spillDroppedFrames() const {
+    return m_spill ? m_spill->dropped() : 0;
+}
+
+bool FrameRecorder::load(const QString &path) {
+    QFile file(path);
+    char magic[sizeof(detail::spill_magic)];
+    if (!file.open(QIODevice::ReadOnly)) {
+        m_error = file.errorString();
+        return false;
+    }
+    if (file.read(magic, sizeof(magic)) != qint64(sizeof(magic))
+        || std::memcmp(magic, detail::spill_magic, sizeof(magic)) != 0)
+    {
+        m_error = QStringLiteral("Not a frame recording");
+        return false;
+    }
+
+    clear();
+
+    // the bounds apply, only the end of long recordings is kept. Times going
+    // backwards, from files appended to by older versions, are shifted to
+    // follow the previous frame.
+    QImage image;
+    qint64 time = 0;
+    qint64 shift = 0;
+    while (detail::readRecord(file, image, time)) {
+        if (!m_frames.empty() && time + shift < m_frames.back().time)
+            shift = m_frames.back().time - time;
+        append(std::move(image), time + shift);
+    }
+
+    // live frames recorded from now on follow the loaded ones
+    if (!m_frames.empty())
+        m_time_offset = m_frames.back().time - m_clock.nsecsElapsed();
+
+    if (!file.atEnd())
+        m_error = QStringLiteral("Truncated frame recording");
+    return !m_frames.empty();
+}
+
+QString FrameRecorder::errorString() const {
+    return m_error;
+}
+
+bool FrameRecorder::isReplaying() const {
+    return m_replaying;
+}
+
+int FrameRecorder::replayPosition() const {
+    return m_replay_next > m_first ? int(m_replay_next - m_first) : 0;
+}
+
+void FrameRecorder::record(const QImage &frame) {
+    // the live display goes first
+    if (!m_replaying)
+        emit frameReady(frame);
+
+    const qint64 time = m_clock.nsecsElapsed() + m_time_offset;
+    QImage image = m_copy ? frame.copy() : frame;
+    if (m_spill)
+        m_spill->push(image, time);
+    append(std::move(image), time);
+}
+
+void FrameRecorder::append(QImage image, qint64 time) {
+    m_bytes += detail::imageBytes(image);
+    m_frames.push_back({std::move(image), time});
+
+    // the newest frame is always kept
+    const qint64 oldest = time - qint64(m_duration) * 1000000;
+    while (m_frames.size() > 1 && (m_bytes > m_capacity || m_frames.front().time < oldest)) {
+        m_bytes -= detail::imageBytes(m_frames.front().image);
+        m_frames.pop_front();
+        ++m_first;
+    }
+}
+
+void FrameRecorder::startReplay(int index, double speed) {
+    if (m_frames.empty() || speed <= 0.)
+        return;
+
+    index = std::max(0, std::min(index, frameCount() - 1));
+    m_replaying = true;
+    m_replay_speed = speed;
+    m_replay_next = m_first + quint64(index);
+    m_replay_origin_time = m_frames[size_t(index)].time;
+    m_replay_clock.start();
+    replayNext();
+}
+
+void FrameRecorder::stopReplay() {
+    m_replay_timer->stop();
+    m_replaying = false;
+}
+
+/*
+ * Frames are due at their recording time relative to the first replayed one,
+ * scaled by the speed. Deadlines are absolute, so timer latencies do not add
+ * up over a replay.
+ */
+void FrameRecorder::replayNext() {
+    if (!m_replaying)
+        return;
+
+    // frames evicted while replaying are skipped
+    m_replay_next = std::max(m_replay_next, m_first);
+    const quint64 index = m_replay_next - m_first;
+    if (index >= m_frames.size()) {
+        stopReplay();
+        emit replayFinished();
+        return;
+    }
+
+    const Frame &f = m_frames[size_t(index)];
+    const qint64 due = qint64(double(f.time - m_replay_origin_time) / m_replay_speed);
+    const qint64 wait = due - m_replay_clock.nsecsElapsed();
+    if (wait > 1000000) {
+        m_replay_timer->start(int(wait / 1000000));
+        return;
+    }
+
+    ++m_replay_next;
+    emit frameReady(f.image);
+    emit replayPositionChanged(int(index));
+    scheduleReplay();
+}
+
+void FrameRecorder::scheduleReplay() {
+    if (!m_replaying)
+        return;
+    if (m_replay_next - m_first >= m_frames.size()) {
+        stopReplay();
+        emit replayFinished();
+        return;
+    }
+    m_replay_timer->start(0);
+}
+
+} // namespace pal
@@ -0,0 +1,262 @@
+#include <algorithm>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLTexture>
+#include <QOpenGLWidget>
+#include <QMatrix4x4>
+#include <QPainter>
+#include "gl-renderer.h"
+
+namespace pal {
+namespace detail {
+
+static const char *vertex_shader =
+    "attribute highp vec2 position;\n"
+    "attribute highp vec2 texcoord;\n"
+    "uniform highp mat4 matrix;\n"
+    "varying highp vec2 v_texcoord;\n"
+    "void main() {\n"
+    "    gl_Position = matrix * vec4(position, 0.0, 1.0);\n"
+    "    v_texcoord = texcoord;\n"
+    "}\n";
+
+static const char *fragment_shader =
+    "uniform sampler2D tile;\n"
+    "uniform lowp float opacity;\n"
+    "varying highp vec2 v_texcoord;\n"
+    "void main() {\n"
+    "    lowp vec4 color = texture2D(tile, v_texcoord);\n"
+    "    gl_FragColor = vec4(color.rgb, color.a * opacity);\n"
+    "}\n";
+
+enum { PositionAttribute = 0, TexCoordAttribute = 1 };
+
+bool isOpenGLAvailable() {
+    // checked once, a context is costly to create
+    static const bool available = [] {
+        QOpenGLContext context;
+        if (!context.create())
+            return false;
+
+        QOffscreenSurface surface;
+        surface.setFormat(context.format());
+        surface.create();
+        if (!surface.isValid() || !context.makeCurrent(&surface))
+            return false;
+
+        const bool shaders = context.functions()->hasOpenGLFeature(QOpenGLFunctions::Shaders);
+        context.doneCurrent();
+        return shaders;
+    }();
+    return available;
+}
+
+GLTileRenderer::GLTileRenderer()
+    : m_key(0)
+    , m_bytes(0)
+    , m_tile_size(1024)
+    , m_mipmaps(true)
+    , m_failed(false)
+{}
+
+GLTileRenderer::~GLTileRenderer() {
+    QObject::disconnect(m_cleanup);
+    if (m_widget) {
+        m_widget->makeCurrent();
+        release();
+        m_widget->doneCurrent();
+    }
+}
+
+qint64 GLTileRenderer::memoryUsage() const {
+    return m_bytes;
+}
+
+void GLTileRenderer::invalidate(const QRect &rect) {
+    m_dirty.append(rect);
+}
+
+void GLTileRenderer::setImageKey(qint64 previous, qint64 key) {
+    if (m_key == previous)
+        m_key = key;
+}
+
+// a full mipmap chain adds a third to the base level
+qint64 GLTileRenderer::textureBytes(const QOpenGLTexture *texture) const {
+    const qint64 bytes = qint64(texture->width()) * texture->height() * 4;
+    return m_mipmaps ? bytes * 4 / 3 : bytes;
+}
+
+void GLTileRenderer::dropDirtyTiles() {
+    const int ts = m_tile_size;
+    for (const QRect &r : m_dirty) {
+        for (int ty = r.top() / ts; ty <= r.bottom() / ts; ++ty) {
+            for (int tx = r.left() / ts; tx <= r.right() / ts; ++tx) {
+                QOpenGLTexture *texture = m_tiles.take((quint32(ty) << 16) | quint32(tx));
+                if (texture) {
+                    m_bytes -= textureBytes(texture);
+                    delete texture;
+                }
+            }
+        }
+    }
+    m_dirty.clear();
+}
+
+// Textures live in the context of one widget, switching widget drops them
+bool GLTileRenderer::bind(QOpenGLWidget *widget) {
+    if (widget == m_widget)
+        return true;
+
+    QObject::disconnect(m_cleanup);
+    if (m_widget) {
+        m_widget->makeCurrent();
+        release();
+        widget->makeCurrent();
+    }
+
+    m_widget = widget;
+    m_cleanup = QObject::connect(widget, &QOpenGLWidget::aboutToBeDestroyed, widget, [this] {
+        release();
+        m_widget = nullptr;
+    });
+    return true;
+}
+
+bool GLTileRenderer::init() {
+    auto program = std::unique_ptr<QOpenGLShaderProgram>(new QOpenGLShaderProgram);
+    if (!program->addShaderFromSourceCode(QOpenGLShader::Vertex, vertex_shader)
+        || !program->addShaderFromSourceCode(QOpenGLShader::Fragment, fragment_shader))
+        return false;
+
+    program->bindAttributeLocation("position", PositionAttribute);
+    program->bindAttributeLocation("texcoord", TexCoordAttribute);
+    if (!program->link())
+        return false;
+
+    auto f = QOpenGLContext::currentContext()->functions();
+    GLint max_size = 0;
+    f->glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+    if (max_size > 0)
+        m_tile_size = std::min(m_tile_size, int(max_size));
+
+    // mipmaps of partial border tiles need non power of two textures
+    m_mipmaps = f->hasOpenGLFeature(QOpenGLFunctions::NPOTTextures);
+    m_program = std::move(program);
+    return true;
+}
+
+void GLTileRenderer::release() {
+    qDeleteAll(m_tiles);
+    m_tiles.clear();
+    m_dirty.clear();
+    m_program.reset();
+    m_key = 0;
+    m_bytes = 0;
+}
+
+QOpenGLTexture *GLTileRenderer::tile(const QImage &image, const QRect &rect, quint32 key) {
+    auto it = m_tiles.constFind(key);
+    if (it != m_tiles.constEnd())
+        return it.value();
+
+    const auto mipmaps = m_mipmaps ? QOpenGLTexture::GenerateMipMaps : QOpenGLTexture::DontGenerateMipMaps;
+    auto texture = new QOpenGLTexture(image.copy(rect), mipmaps);
+    texture->setWrapMode(QOpenGLTexture::ClampToEdge);
+    texture->setMinificationFilter(m_mipmaps ? QOpenGLTexture::LinearMipMapLinear : QOpenGLTexture::Linear);
+    m_tiles.insert(key, texture);
+    m_bytes += textureBytes(texture);
+    return texture;
+}
+
+/*
+ * The painter transform becomes the matrix of the vertex shader, which sees
+ * item coordinates. The GL paint engine renders in logical pixels, hence the
+ * projection from the logical size of the widget.
+ */
+bool GLTileRenderer::paint(QPainter *painter, QWidget *widget, const QImage &image,
+                           const QRectF &exposed, const QPointF &offset, bool smooth)
+{
+    auto gl_widget = qobject_cast<QOpenGLWidget*>(widget);
+    if (!gl_widget || m_failed || image.isNull())
+        return false;
+
+    const QTransform transform = painter->combinedTransform();
+    const qreal opacity = painter->opacity();
+
+    painter->beginNativePainting();
+
+    if (!bind(gl_widget) || (!m_program && !init())) {
+        painter->endNativePainting();
+        m_failed = true;
+        return false;
+    }
+
+    if (image.cacheKey() != m_key) {
+        qDeleteAll(m_tiles);
+        m_tiles.clear();
+        m_key = image.cacheKey();
+        m_bytes = 0;
+        m_dirty.clear();
+    }
+    dropDirtyTiles();
+
+    auto f = QOpenGLContext::currentContext()->functions();
+    if (image.hasAlphaChannel() || opacity < 1.0) {
+        // textures are not premultiplied
+        f->glEnable(GL_BLEND);
+        f->glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    }
+    else {
+        f->glDisable(GL_BLEND);
+    }
+    f->glActiveTexture(GL_TEXTURE0);
+
+    QMatrix4x4 matrix;
+    matrix.ortho(0, widget->width(), widget->height(), 0, -1, 1);
+    matrix *= QMatrix4x4(transform);
+
+    m_program->bind();
+    m_program->setUniformValue("matrix", matrix);
+    m_program->setUniformValue("tile", 0);
+    m_program->setUniformValue("opacity", GLfloat(opacity));
+    m_program->enableAttributeArray(PositionAttribute);
+    m_program->enableAttributeArray(TexCoordAttribute);
+
+    static const GLfloat texcoords[] = {0, 0, 1, 0, 0, 1, 1, 1};
+    m_program->setAttributeArray(TexCoordAttribute, texcoords, 2);
+
+    const int ts = m_tile_size;
+    const QRect bounds = image.rect();
+    const QRect visible = exposed.toAlignedRect() & bounds;
+
+    for (int ty = visible.top() / ts; !visible.isEmpty() && ty <= visible.bottom() / ts; ++ty) {
+        for (int tx = visible.left() / ts; tx <= visible.right() / ts; ++tx) {
+            const QRect src = QRect(tx * ts, ty * ts, ts, ts) & bounds;
+            QOpenGLTexture *texture = tile(image, src, (quint32(ty) << 16) | quint32(tx));
+            texture->setMagnificationFilter(smooth ? QOpenGLTexture::Linear : QOpenGLTexture::Nearest);
+            texture->bind();
+
+            const QRectF r = QRectF(src).translated(offset);
+            const GLfloat positions[] = {
+                GLfloat(r.left()), GLfloat(r.top()), GLfloat(r.right()), GLfloat(r.top()),
+                GLfloat(r.left()), GLfloat(r.bottom()), GLfloat(r.right()), GLfloat(r.bottom())
+            };
+            m_program->setAttributeArray(PositionAttribute, positions, 2);
+            f->glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+            texture->release();
+        }
+    }
+
+    m_program->disableAttributeArray(PositionAttribute);
+    m_program->disableAttributeArray(TexCoordAttribute);
+    m_program->release();
+
+    painter->endNativePainting();
+    return true;
+}
+
+} // namespace detail
+} // namespace pal
@@ -0,0 +1,73 @@
+#pragma once
+#include <memory>
+#include <QHash>
+#include <QImage>
+#include <QMetaObject>
+#include <QPointer>
+#include <QVector>
+
+QT_BEGIN_NAMESPACE
+class QOpenGLShaderProgram;
+class QOpenGLTexture;
+class QOpenGLWidget;
+class QPainter;
+QT_END_NAMESPACE
+
+namespace pal {
+namespace detail {
+
+/// Whether an OpenGL context with shader support can be created
+bool isOpenGLAvailable();
+
+/**
+ * Draws an image in a QOpenGLWidget as a grid of mipmapped textures.
+ *
+ * Tiles are uploaded once per image, the first time they are visible, and
+ * the view transform is applied by the GPU. Textures belong to the context
+ * of the widget last painted into, and are released along with it.
+ */
+class GLTileRenderer {
+public:
+    GLTileRenderer();
+    ~GLTileRenderer();
+
+    /**
+     * Draw the exposed part of the image at offset, in item coordinates.
+     * Returns false if the painter does not paint into a QOpenGLWidget or
+     * if OpenGL resources could not be set up.
+     */
+    bool paint(QPainter *painter, QWidget *widget, const QImage &image,
+               const QRectF &exposed, const QPointF &offset, bool smooth);
+
+    /// Texture memory held, in bytes
+    qint64 memoryUsage() const;
+
+    /// Pixels of the image changed, reload them on next paint
+    void invalidate(const QRect &rect);
+
+    /// The image was written in place, only in the invalidated areas
+    void setImageKey(qint64 previous, qint64 key);
+
+private:
+    bool bind(QOpenGLWidget *widget);
+    bool init();
+    QOpenGLTexture *tile(const QImage &image, const QRect &rect, quint32 key);
+    qint64 textureBytes(const QOpenGLTexture *texture) const;
+    void dropDirtyTiles();
+    void release();  // needs the context to be current
+
+private:
+    QPointer<QOpenGLWidget> m_widget;
+    QMetaObject::Connection m_cleanup;
+    std::unique_ptr<QOpenGLShaderProgram> m_program;
+    QHash<quint32, QOpenGLTexture*> m_tiles;
+    QVector<QRect> m_dirty;
+    qint64 m_key;
+    qint64 m_bytes;
+    int m_tile_size;
+    bool m_mipmaps;
+    bool m_failed;
+};
+
+} // namespace detail
+} // namespace pal
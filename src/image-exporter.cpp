@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <QFileInfo>
+#include <QImageWriter>
+#include <QSaveFile>
+#include "pal/image-exporter.h"
+#include "parallel.h"
+
+namespace pal {
+namespace detail {
+
+// State shared by an export and its exporter, which may be gone before it ends
+struct ExportJob {
+    std::mutex mutex;
+    ImageExporter *receiver = nullptr;
+    std::atomic<bool> cancelled{false};
+    int percent = -1;  // last progress reported, worker side
+};
+
+static void reportProgress(ExportJob &job, double done) {
+    const int percent = std::min(100, int(done * 100));
+    if (percent == job.percent)
+        return;
+    job.percent = percent;
+
+    std::lock_guard<std::mutex> lock(job.mutex);
+    ImageExporter *exporter = job.receiver;
+    if (exporter)
+        QMetaObject::invokeMethod(exporter, [exporter, done] { emit exporter->progress(std::min(done, 1.0)); },
+                                  Qt::QueuedConnection);
+}
+
+// File failing writes once its export is cancelled, which makes encoders
+// give up, and reporting progress against an expected size
+class ExportFile : public QSaveFile {
+public:
+    ExportFile(const QString &path, ExportJob &job, qint64 expected)
+        : QSaveFile(path)
+        , m_job(job)
+        , m_expected(expected)
+        , m_written(0)
+    {}
+
+protected:
+    qint64 writeData(const char *data, qint64 len) override {
+        if (m_job.cancelled.load(std::memory_order_relaxed))
+            return -1;
+        const qint64 written = QSaveFile::writeData(data, len);
+        if (written > 0 && m_expected > 0) {
+            m_written += written;
+            reportProgress(m_job, double(m_written) / m_expected);
+        }
+        return written;
+    }
+
+private:
+    ExportJob &m_job;
+    qint64 m_expected;
+    qint64 m_written;
+};
+
+static bool writeImage(ExportJob &job, const QImage &image, const QString &path,
+                       ImageExporter::Format format, QString &error)
+{
+    const qint64 line = (qint64(image.width()) * image.depth() + 7) / 8;
+    ExportFile file(path, job, format == ImageExporter::Format::Png ? 0 : line * image.height());
+    if (!file.open(QIODevice::WriteOnly)) {
+        error = file.errorString();
+        return false;
+    }
+    reportProgress(job, 0.0);
+
+    bool ok = true;
+    if (format == ImageExporter::Format::Raw) {
+        for (int y = 0; ok && y < image.height(); ++y)
+            ok = file.write(reinterpret_cast<const char*>(image.constScanLine(y)), line) == line;
+    } else {
+        QImageWriter writer(&file, format == ImageExporter::Format::Png ? "png" : "tiff");
+        ok = writer.write(image);
+        if (!ok)
+            error = writer.errorString();
+    }
+
+    if (job.cancelled.load(std::memory_order_relaxed)) {
+        file.cancelWriting();
+        error = QStringLiteral("Export cancelled");
+        return false;
+    }
+    if (!ok || !file.commit()) {
+        if (error.isEmpty())
+            error = file.errorString();
+        return false;
+    }
+    reportProgress(job, 1.0);
+    return true;
+}
+
+static void releaseImage(void *info) {
+    delete static_cast<QImage*>(info);
+}
+
+} // namespace detail
+
+
+QImage imageView(const QImage &image, const QRect &rect) {
+    const QRect area = rect & image.rect();
+    if (area.isEmpty())
+        return QImage();
+    if (image.depth() < 8)
+        return image.copy(area);
+
+    // the view holds a reference to the image, constBits() does not detach
+    const uchar *bits = image.constBits() + ptrdiff_t(area.y()) * image.bytesPerLine()
+                      + ptrdiff_t(area.x()) * (image.depth() / 8);
+    QImage view(bits, area.width(), area.height(), image.bytesPerLine(), image.format(),
+                detail::releaseImage, new QImage(image));
+    view.setColorTable(image.colorTable());
+    view.setDotsPerMeterX(image.dotsPerMeterX());
+    view.setDotsPerMeterY(image.dotsPerMeterY());
+    return view;
+}
+
+
+ImageExporter::ImageExporter(QObject *parent)
+    : QObject(parent)
+{}
+
+ImageExporter::~ImageExporter() {
+    // a running export completes its file, unless told otherwise
+    if (m_job) {
+        std::lock_guard<std::mutex> lock(m_job->mutex);
+        m_job->receiver = nullptr;
+    }
+}
+
+ImageExporter::Format ImageExporter::formatFor(const QString &path) {
+    const QString suffix = QFileInfo(path).suffix().toLower();
+    if (suffix == QLatin1String("tif") || suffix == QLatin1String("tiff"))
+        return Format::Tiff;
+    if (suffix == QLatin1String("raw") || suffix == QLatin1String("bin"))
+        return Format::Raw;
+    return Format::Png;
+}
+
+bool ImageExporter::save(const QImage &image, const QString &path) {
+    return save(image, path, formatFor(path));
+}
+
+bool ImageExporter::save(const QImage &image, const QString &path, Format format) {
+    if (m_job) {
+        m_error = QStringLiteral("An export is running already");
+        return false;
+    }
+    if (image.isNull()) {
+        m_error = QStringLiteral("Null image");
+        return false;
+    }
+
+    auto job = std::make_shared<detail::ExportJob>();
+    job->receiver = this;
+    m_job = job;
+    m_error.clear();
+
+    detail::runAsync([job, image, path, format] {
+        QString error;
+        const bool ok = detail::writeImage(*job, image, path, format, error);
+        std::lock_guard<std::mutex> lock(job->mutex);
+        ImageExporter *exporter = job->receiver;
+        if (exporter)
+            QMetaObject::invokeMethod(exporter, [exporter, ok, error] { exporter->done(ok, error); },
+                                      Qt::QueuedConnection);
+    });
+    return true;
+}
+
+bool ImageExporter::isBusy() const {
+    return bool(m_job);
+}
+
+QString ImageExporter::errorString() const {
+    return m_error;
+}
+
+void ImageExporter::cancel() {
+    if (m_job)
+        m_job->cancelled.store(true, std::memory_order_relaxed);
+}
+
+void ImageExporter::done(bool ok, const QString &error) {
+    m_job.reset();
+    m_error = error;
+    emit finished(ok);
+}
+
+} // namespace pal
@@ -1,18 +1,50 @@
 #define _USE_MATH_DEFINES
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <mutex>
+#include <vector>
 #include <QApplication>
+#include <QCache>
+#include <QCursor>
+#include <QElapsedTimer>
 #include <QEnterEvent>
 #include <QGraphicsScene>
 #include <QGraphicsSceneHoverEvent>
 #include <QGraphicsView>
 #include <QHBoxLayout>
 #include <QLabel>
+#include <QMouseEvent>
+#include <QPaintEvent>
+#include <QPainter>
 #include <QScrollBar>
+#include <QStyleOptionGraphicsItem>
+#include <QTimer>
 #include <QToolButton>
 #include <QVBoxLayout>
 #include <QWheelEvent>
 #include "pal/image-viewer.h"
+#include "pal/compressed-image-cache.h"
+#include "pal/pyramid-cache.h"
+#include "bayer-source.h"
+#include "clahe-source.h"
+#include "composite-source.h"
+#include "kernels.h"
+#include "parallel.h"
+#include "render-stats.h"
+#include "tile-source.h"
+
+#if PAL_IMAGE_VIEWER_OPENGL
+#include <QOpenGLWidget>
+#include <QPaintEngine>
+#include "gl-renderer.h"
+#else
+namespace pal {
+namespace detail {
+class GLTileRenderer {};
+}
+}
+#endif
 
 static void init_image_viewer_resource() {
     // This must be done outside of any namespace
@@ -21,6 +53,24 @@ static void init_image_viewer_resource() {
 
 namespace pal {
 
+// Toolbar icons, loaded once and shared by all the viewers
+struct ToolIcons {
+    QIcon fit;
+    QIcon original;
+    QIcon loupe;
+};
+
+static const ToolIcons &toolIcons() {
+    static std::once_flag inititialized;
+    std::call_once(inititialized, init_image_viewer_resource);
+
+    // leaked on purpose: destroying QIcons after QApplication would crash
+    static const ToolIcons *icons = new ToolIcons{QIcon(QStringLiteral(":zoom-fit")),
+                                                  QIcon(QStringLiteral(":zoom-1")),
+                                                  QIcon(QStringLiteral(":loupe"))};
+    return *icons;
+}
+
 // Graphics View with better mouse events handling
 class GraphicsView : public QGraphicsView {
     Q_OBJECT
@@ -28,10 +78,9 @@ public:
     explicit GraphicsView(ImageViewer *viewer)
         : QGraphicsView()
         , m_viewer(viewer)
+        , m_stats(nullptr)
+        , m_opengl(false)
     {
-        static std::once_flag inititialized;
-        std::call_once(inititialized, init_image_viewer_resource);
-
         // no antialiasing or filtering, we want to see the exact image content
         setRenderHint(QPainter::Antialiasing, false);
         setDragMode(QGraphicsView::ScrollHandDrag);
@@ -44,7 +93,29 @@ public:
         setMouseTracking(true);
     }
 
+    void setStatsCounters(detail::StatsCounters *stats) {
+        m_stats = stats;
+    }
+
+    bool isOpenGLEnabled() const {
+        return m_opengl;
+    }
+
+    bool setOpenGLEnabled(bool on);
+
 protected:
+    void paintEvent(QPaintEvent *event) override {
+        const bool timed = m_stats && m_stats->isEnabled();
+        QElapsedTimer timer;
+        if (timed)
+            timer.start();
+
+        QGraphicsView::paintEvent(event);
+
+        if (timed)
+            m_stats->addPaint(timer.nsecsElapsed());
+    }
+
     void wheelEvent(QWheelEvent *event) override {
         const auto d = event->angleDelta();
 
@@ -76,69 +147,458 @@ protected:
 
 private:
     ImageViewer *m_viewer;
+    detail::StatsCounters *m_stats;
+    bool m_opengl;
+};
+
+// The OpenGL viewport redraws everything on every update, the GPU being fast
+// enough at it
+bool GraphicsView::setOpenGLEnabled(bool on) {
+    if (on == m_opengl)
+        return true;
+
+#if PAL_IMAGE_VIEWER_OPENGL
+    if (on && !detail::isOpenGLAvailable())
+        return false;
+
+    // the previous viewport gets deleted, not the overlays on it
+    QWidget *viewport_widget = on ? new QOpenGLWidget : new QWidget;
+    for (QWidget *overlay : viewport()->findChildren<QWidget*>(QString(), Qt::FindDirectChildrenOnly)) {
+        const bool visible = overlay->isVisibleTo(viewport());
+        overlay->setParent(viewport_widget);
+        overlay->setVisible(visible);
+    }
+    setViewport(viewport_widget);
+    setViewportUpdateMode(on ? QGraphicsView::FullViewportUpdate : QGraphicsView::SmartViewportUpdate);
+    viewport()->setMouseTracking(true);
+
+    m_opengl = on;
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+// Image pixels shown by an item, which may have no image() of its own, such
+// as compressed cached images
+static QRect imageBounds(const PixmapItem *item) {
+    return QRect(QPoint(), item->boundingRect().size().toSize());
+}
+
+// Magnified pixels around the cursor, with their values. The loupe is a
+// window of its own, so that following the cursor never repaints the view
+// underneath, and it is rendered into a buffer from the image data.
+class Loupe : public QWidget {
+public:
+    static const int radius = 4;  // pixels shown on each side of the center
+    static const int cell = 36;   // on-screen size of a pixel, grid line included
+
+    explicit Loupe(QWidget *parent)
+        : QWidget(parent, Qt::ToolTip | Qt::FramelessWindowHint)
+        , m_buffer(side(), side(), QImage::Format_RGB32)
+    {
+        setAttribute(Qt::WA_ShowWithoutActivating);
+        setAttribute(Qt::WA_TransparentForMouseEvents);
+        setAttribute(Qt::WA_OpaquePaintEvent);
+        setFixedSize(side(), side());
+    }
+
+    // show the pixels around pixel beside the cursor, within bounds if possible
+    void showAt(const PixmapItem *item, const QPoint &pixel, const QPoint &cursor, const QRect &bounds) {
+        render(item, pixel);
+
+        const int gap = 24;
+        QPoint pos = cursor + QPoint(gap, gap);
+        if (pos.x() + width() > bounds.right())
+            pos.rx() = cursor.x() - gap - width();
+        if (pos.y() + height() > bounds.bottom())
+            pos.ry() = cursor.y() - gap - height();
+        move(pos);
+
+        show();
+        update();
+    }
+
+protected:
+    void paintEvent(QPaintEvent *event) override {
+        Q_UNUSED(event)
+        QPainter painter(this);
+        painter.drawImage(0, 0, m_buffer);
+    }
+
+private:
+    static int side() {
+        return (2 * radius + 1) * cell + 1;
+    }
+
+    // raw sample value, gray levels as they are, colors as components, the
+    // displayed color without image
+    static QString sampleText(const QImage &image, const QPoint &p, QRgb displayed) {
+        if (image.format() == QImage::Format_Grayscale8)
+            return QString::number(image.constScanLine(p.y())[p.x()]);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 13, 0)
+        if (image.format() == QImage::Format_Grayscale16)
+            return QString::number(reinterpret_cast<const quint16*>(image.constScanLine(p.y()))[p.x()]);
+#endif
+        const QRgb rgb = image.valid(p) ? image.pixel(p) : displayed;
+        return QStringLiteral("%1\n%2\n%3").arg(qRed(rgb)).arg(qGreen(rgb)).arg(qBlue(rgb));
+    }
+
+    void render(const PixmapItem *item, const QPoint &pixel) {
+        const int n = 2 * radius + 1;
+        const QRect area(pixel - QPoint(radius, radius), QSize(n, n));
+        const QRect shown = area & imageBounds(item);
+        const QImage pixels = item->displayArea(shown);
+
+        // cells leave a gap, which the background fills as grid lines
+        QPainter painter(&m_buffer);
+        painter.fillRect(m_buffer.rect(), palette().color(QPalette::Dark));
+        QFont font = painter.font();
+        font.setPixelSize(9);
+        painter.setFont(font);
+
+        for (int j = 0; j < n; ++j) {
+            for (int i = 0; i < n; ++i) {
+                const QPoint p = area.topLeft() + QPoint(i, j);
+                const QRect r(i * cell + 1, j * cell + 1, cell - 1, cell - 1);
+                if (!shown.contains(p) || pixels.isNull()) {
+                    painter.fillRect(r, palette().color(QPalette::Window));
+                    continue;
+                }
+
+                const QRgb rgb = pixels.pixel(p - shown.topLeft());
+                painter.fillRect(r, QColor(rgb));
+                painter.setPen(qGray(rgb) < 128 ? Qt::white : Qt::black);
+                painter.drawText(r, Qt::AlignCenter, sampleText(item->image(), p, rgb));
+            }
+        }
+
+        painter.setPen(QPen(palette().color(QPalette::Highlight), 2));
+        painter.drawRect(QRect(radius * cell + 1, radius * cell + 1, cell - 1, cell - 1));
+    }
+
+private:
+    QImage m_buffer;
 };
 
 
+// Thumbnail of a whole image, about side pixels on its longest side. Tile
+// sources render it from a coarse level, other images get point sampled, so
+// that only the thumbnail pixels are read. Runs on any thread.
+static QImage overviewThumbnail(const QImage &image, const std::shared_ptr<detail::TileSource> &source, int side) {
+    if (source) {
+        int level = 0;
+        QSize size = source->levelSize(level);
+        while (std::max(size.width(), size.height()) > side && level < 31)
+            size = source->levelSize(++level);
+        return source->render(QRect(QPoint(), size), level, false);
+    }
+
+    if (image.isNull())
+        return QImage();
+
+    QSize size = image.size();
+    if (std::max(size.width(), size.height()) > side)
+        size = size.scaled(side, side, Qt::KeepAspectRatio).expandedTo(QSize(1, 1));
+
+    QImage thumbnail(size, image.hasAlphaChannel() ? QImage::Format_ARGB32 : QImage::Format_RGB32);
+    for (int y = 0; y < size.height(); ++y) {
+        const int sy = int((qint64(2 * y + 1) * image.height()) / (2 * size.height()));
+        QRgb *line = reinterpret_cast<QRgb*>(thumbnail.scanLine(y));
+        for (int x = 0; x < size.width(); ++x)
+            line[x] = image.pixel(int((qint64(2 * x + 1) * image.width()) / (2 * size.width())), sy);
+    }
+    return thumbnail;
+}
+
+// Whole image with the visible area outlined, clicking or dragging centers
+// the view there. It is only shown while the view does not show the whole
+// image. The thumbnail gets built in the background, one image at a time:
+// while streaming, the images that arrived in the meantime are skipped.
+class Overview : public QWidget {
+public:
+    static const int side = 160;         // on-screen size of the longest side
+    static const int sampled_side = 256;  // thumbnail size, sharper on high DPI screens
+
+    // a child of the viewport, which scrolls its pixels and it along, a
+    // sibling overlapping it would have the whole viewport repainted instead
+    explicit Overview(GraphicsView *view)
+        : QWidget(view->viewport())
+        , m_view(view)
+        , m_shared(std::make_shared<Shared>())
+        , m_building(false)
+        , m_pending(false)
+    {
+        m_shared->receiver = this;
+        setAttribute(Qt::WA_OpaquePaintEvent);
+        setCursor(Qt::PointingHandCursor);
+        hide();
+    }
+
+    ~Overview() override {
+        // a build finishing later has nobody to deliver to
+        std::lock_guard<std::mutex> lock(m_shared->mutex);
+        m_shared->receiver = nullptr;
+    }
+
+    void setImage(const QImage &image, std::shared_ptr<detail::TileSource> source) {
+        m_pending_image = image;
+        m_pending_source = std::move(source);
+        m_pending = true;
+        if (!m_building)
+            build();
+    }
+
+    // follow the view, shown while it does not show the whole image
+    void updateViewport() {
+        const QRectF image = m_view->sceneRect();
+        m_visible = m_view->mapToScene(m_view->viewport()->rect());
+
+        bool whole = true;
+        for (const QPointF &p : {image.topLeft(), image.topRight(), image.bottomLeft(), image.bottomRight()})
+            whole = whole && m_visible.containsPoint(p, Qt::OddEvenFill);
+
+        if (image.isEmpty() || whole) {
+            hide();
+            return;
+        }
+
+        // scrolling moved it along with the viewport pixels
+        const QSize size = image.size().toSize().scaled(side, side, Qt::KeepAspectRatio).expandedTo(QSize(1, 1));
+        setFixedSize(size);
+        const QRect area = m_view->viewport()->rect();
+        move(area.right() - size.width() - 8, area.bottom() - size.height() - 8);
+        show();
+        update();
+    }
+
+protected:
+    void paintEvent(QPaintEvent *event) override {
+        Q_UNUSED(event)
+        QPainter painter(this);
+        painter.fillRect(rect(), palette().color(QPalette::Window));
+        painter.setRenderHint(QPainter::SmoothPixmapTransform);
+        if (!m_thumbnail.isNull())
+            painter.drawImage(rect(), m_thumbnail);
+
+        const QRectF image = m_view->sceneRect();
+        if (image.isEmpty())
+            return;
+
+        QTransform t;
+        t.scale(width() / image.width(), height() / image.height());
+        t.translate(-image.x(), -image.y());
+
+        const QColor highlight = palette().color(QPalette::Highlight);
+        QColor fill = highlight;
+        fill.setAlpha(48);
+        painter.setRenderHint(QPainter::Antialiasing);
+        painter.setPen(QPen(highlight, 1.5));
+        painter.setBrush(fill);
+        painter.drawPolygon(t.map(m_visible));
+
+        painter.setRenderHint(QPainter::Antialiasing, false);
+        painter.setPen(palette().color(QPalette::Dark));
+        painter.setBrush(Qt::NoBrush);
+        painter.drawRect(rect().adjusted(0, 0, -1, -1));
+    }
+
+    void mousePressEvent(QMouseEvent *event) override {
+        if (event->button() == Qt::LeftButton)
+            centerAt(event->pos());
+    }
+
+    void mouseMoveEvent(QMouseEvent *event) override {
+        if (event->buttons() & Qt::LeftButton)
+            centerAt(event->pos());
+    }
+
+private:
+    struct Shared {
+        std::mutex mutex;
+        Overview *receiver;
+    };
+
+    void centerAt(const QPoint &pos) {
+        const QRectF image = m_view->sceneRect();
+        m_view->centerOn(image.x() + (pos.x() + 0.5) * image.width() / width(),
+                         image.y() + (pos.y() + 0.5) * image.height() / height());
+    }
+
+    void build() {
+        m_building = true;
+        m_pending = false;
+        const QImage image = std::move(m_pending_image);
+        const std::shared_ptr<detail::TileSource> source = std::move(m_pending_source);
+        m_pending_image = QImage();
+        m_pending_source.reset();
+
+        const std::shared_ptr<Shared> shared = m_shared;
+        detail::runAsync([shared, image, source] {
+            const QImage thumbnail = overviewThumbnail(image, source, sampled_side);
+            std::lock_guard<std::mutex> lock(shared->mutex);
+            Overview *overview = shared->receiver;
+            if (overview)
+                QMetaObject::invokeMethod(overview, [overview, thumbnail] { overview->built(thumbnail); },
+                                          Qt::QueuedConnection);
+        });
+    }
+
+    void built(const QImage &thumbnail) {
+        m_thumbnail = thumbnail;
+        m_building = false;
+        if (m_pending)
+            build();
+        update();
+    }
+
+private:
+    GraphicsView *m_view;
+    std::shared_ptr<Shared> m_shared;
+    QImage m_thumbnail;
+    QPolygonF m_visible;
+    bool m_building;
+    bool m_pending;
+    QImage m_pending_image;
+    std::shared_ptr<detail::TileSource> m_pending_source;
+};
+
+/*
+ * Construction is kept cheap, so that walls of hundreds of viewers can be
+ * created quickly: the graphics scene and view are only set up when first
+ * shown or accessed, the toolbar when it first needs to be visible, and the
+ * settings changed in the meantime are applied at that point.
+ */
 ImageViewer::ImageViewer(QWidget *parent)
     : QFrame(parent)
     , m_zoom_level(0)
+    , m_text_label(nullptr)
+    , m_pixel_value(nullptr)
+    , m_stats_label(nullptr)
+    , m_view(nullptr)
+    , m_loupe(nullptr)
+    , m_overview(nullptr)
+    , m_toolbar(nullptr)
+    , m_loupe_button(nullptr)
+    , m_stats_timer(nullptr)
+    , m_stats_presented(0)
+    , m_rotation(0.)
     , m_fit(true)
+    , m_antialiasing(false)
+    , m_stats_overlay(false)
     , m_bar_mode(ToolBarMode::Visible)
     , m_aspect_ratio_mode(Qt::KeepAspectRatio)
+    , m_backend(Backend::Raster)
 {
-    auto scene = new QGraphicsScene(this);
-    m_view = new GraphicsView(this);
-    m_view->setScene(scene);
-
     // graphic object holding the image buffer
     m_pixmap = new PixmapItem;
-    scene->addItem(m_pixmap);
     connect(m_pixmap, &PixmapItem::mouseMoved, this, &ImageViewer::mouseAt);
     connect(m_pixmap, &PixmapItem::sizeChanged, this, &ImageViewer::updateSceneRect);
 
-    makeToolbar();
-
     auto box = new QVBoxLayout;
     box->setContentsMargins(5,0,5,0);
-    box->addWidget(m_toolbar);
-    box->addWidget(m_view, 1);
     setLayout(box);
 }
 
+ImageViewer::~ImageViewer() {
+    // the scene owns the pixmap once created
+    if (!m_pixmap->scene())
+        delete m_pixmap;
+}
+
+void ImageViewer::setupView() {
+    if (m_view)
+        return;
+
+    auto scene = new QGraphicsScene(this);
+    m_view = new GraphicsView(this);
+    m_view->setScene(scene);
+    m_view->setRenderHint(QPainter::Antialiasing, m_antialiasing);
+    m_view->setStatsCounters(m_pixmap->m_stats.get());
+    if (!m_view->setOpenGLEnabled(m_backend == Backend::OpenGL))
+        m_backend = Backend::Raster;
+
+    scene->addItem(m_pixmap);
+    scene->setSceneRect(m_pixmap->boundingRect());
+
+    static_cast<QVBoxLayout*>(layout())->addWidget(m_view, 1);
+    if (isVisible())
+        m_view->show();
+
+    // pending view settings
+    m_view->rotate(m_rotation);
+    if (m_fit)
+        zoomFit();
+    else
+        setMatrix();
+}
+
 // toolbar with a few quick actions and display information
 void ImageViewer::makeToolbar() {
+    if (m_toolbar)
+        return;
+
     // text and value at pixel
-    m_text_label = new QLabel(this);
+    m_text_label = new QLabel(m_text, this);
     m_text_label->setStyleSheet(QStringLiteral("QLabel { font-weight: bold; }"));
     m_pixel_value = new QLabel(this);
+    m_stats_label = new QLabel(this);
+    m_stats_label->setVisible(m_stats_overlay);
 
     auto fit = new QToolButton(this);
     fit->setToolTip(tr("Fit image to window"));
-    fit->setIcon(QIcon(":zoom-fit"));
+    fit->setIcon(toolIcons().fit);
     connect(fit, &QToolButton::clicked, this, &ImageViewer::zoomFit);
 
     auto orig = new QToolButton(this);
     orig->setToolTip(tr("Resize image to its original size"));
-    orig->setIcon(QIcon(":zoom-1"));
+    orig->setIcon(toolIcons().original);
     connect(orig, &QToolButton::clicked, this, &ImageViewer::zoomOriginal);
 
+    m_loupe_button = new QToolButton(this);
+    m_loupe_button->setToolTip(tr("Magnify the pixels under the cursor"));
+    m_loupe_button->setIcon(toolIcons().loupe);
+    m_loupe_button->setCheckable(true);
+    m_loupe_button->setChecked(isLoupeEnabled());
+    connect(m_loupe_button, &QToolButton::toggled, this, &ImageViewer::setLoupeEnabled);
+
     m_toolbar = new QWidget;
     auto box = new QHBoxLayout(m_toolbar);
     m_toolbar->setContentsMargins(0,0,0,0);
     box->setContentsMargins(0,0,0,0);
     box->addWidget(m_text_label);
     box->addStretch(1);
+    box->addWidget(m_stats_label);
     box->addWidget(m_pixel_value);
     box->addWidget(fit);
     box->addWidget(orig);
+    box->addWidget(m_loupe_button);
+
+    static_cast<QVBoxLayout*>(layout())->insertWidget(0, m_toolbar);
+    updateToolbarVisibility();
+}
+
+void ImageViewer::updateToolbarVisibility() {
+    const bool visible = m_bar_mode == ToolBarMode::Visible
+                      || (m_bar_mode == ToolBarMode::AutoHidden && underMouse());
+
+    // the toolbar is only built once needed
+    if (!m_toolbar && !(visible && isVisible()))
+        return;
+
+    makeToolbar();
+    m_toolbar->setVisible(visible);
 }
 
 QString ImageViewer::text() const {
-    return m_text_label->text();
+    return m_text;
 }
 
 void ImageViewer::setText(const QString &txt) {
-    m_text_label->setText(txt);
+    m_text = txt;
+    if (m_text_label)
+        m_text_label->setText(txt);
 }
 
 const QImage &ImageViewer::image() const {
@@ -146,7 +606,9 @@ const QImage &ImageViewer::image() const {
 }
 
 void ImageViewer::setImage(const QImage &im) {
-    m_pixmap->setImage(im);
+    // identical images change nothing
+    if (!m_pixmap->updateImage(im))
+        return;
 
     if (m_fit)
         zoomFit();
@@ -174,27 +636,26 @@ ImageViewer::ToolBarMode ImageViewer::toolBarMode() const {
 
 void ImageViewer::setToolBarMode(ToolBarMode mode) {
     m_bar_mode = mode;
-    if (mode == ToolBarMode::Hidden)
-        m_toolbar->hide();
-    else if (mode == ToolBarMode::Visible)
-        m_toolbar->show();
-    else
-        m_toolbar->setVisible(underMouse());
+    updateToolbarVisibility();
 }
 
 bool ImageViewer::isAntialiasingEnabled() const {
-    return m_view->renderHints() & QPainter::Antialiasing;
+    return m_antialiasing;
 }
 
 void ImageViewer::enableAntialiasing(bool on) {
-    m_view->setRenderHint(QPainter::Antialiasing, on);
+    m_antialiasing = on;
+    if (m_view)
+        m_view->setRenderHint(QPainter::Antialiasing, on);
 }
 
 QGraphicsView *ImageViewer::view() const {
+    const_cast<ImageViewer*>(this)->setupView();
     return m_view;
 }
 
 void ImageViewer::addTool(QWidget *tool) {
+    makeToolbar();
     m_toolbar->layout()->addWidget(tool);
 }
 
@@ -202,22 +663,243 @@ Qt::AspectRatioMode ImageViewer::aspectRatioMode() const {
     return m_aspect_ratio_mode;
 }
 
+bool ImageViewer::isStatsEnabled() const {
+    return m_pixmap->isStatsEnabled();
+}
+
+void ImageViewer::setStatsEnabled(bool on) {
+    m_pixmap->setStatsEnabled(on);
+
+    if (!m_pixmap->isStatsEnabled()) {
+        if (m_stats_timer)
+            m_stats_timer->stop();
+        setStatsOverlayVisible(false);
+        return;
+    }
+
+    if (!m_stats_timer) {
+        m_stats_timer = new QTimer(this);
+        m_stats_timer->setInterval(500);
+        connect(m_stats_timer, &QTimer::timeout, this, &ImageViewer::publishStats);
+    }
+
+    m_stats_presented = m_pixmap->renderStats().framesPresented;
+    m_stats_clock.start();
+    m_stats_timer->start();
+}
+
+RenderStats ImageViewer::renderStats() const {
+    return m_pixmap->renderStats();
+}
+
+void ImageViewer::resetStats() {
+    m_pixmap->resetStats();
+    m_stats_presented = 0;
+}
+
+bool ImageViewer::isStatsOverlayVisible() const {
+    return m_stats_overlay;
+}
+
+void ImageViewer::setStatsOverlayVisible(bool on) {
+    if (on && !isStatsEnabled())
+        setStatsEnabled(true);
+    m_stats_overlay = on && isStatsEnabled();
+    if (m_stats_label)
+        m_stats_label->setVisible(m_stats_overlay);
+}
+
+void ImageViewer::publishStats() {
+    const RenderStats stats = renderStats();
+
+    const qint64 elapsed = m_stats_clock.restart();
+    const quint64 presented = stats.framesPresented - m_stats_presented;
+    const double fps = elapsed > 0 ? 1000.0 * double(presented) / double(elapsed) : 0.0;
+    m_stats_presented = stats.framesPresented;
+
+    if (m_stats_overlay && m_stats_label) {
+        auto ms = [](qint64 ns) { return QString::number(double(ns) / 1e6, 'f', 1); };
+        m_stats_label->setText(tr("conv %1 ms | upload %2 ms | paint %3 ms | %4 fps | %5 dropped | %6 MiB")
+                               .arg(ms(stats.conversionTime), ms(stats.uploadTime), ms(stats.paintTime))
+                               .arg(fps, 0, 'f', 1)
+                               .arg(stats.framesDropped)
+                               .arg(double(stats.memoryUsage) / (1024. * 1024.), 0, 'f', 1));
+    }
+
+    emit statsUpdated(stats);
+}
+
+bool ImageViewer::isFingerprintingEnabled() const {
+    return m_pixmap->isFingerprintingEnabled();
+}
+
+void ImageViewer::setFingerprintingEnabled(bool on) {
+    m_pixmap->setFingerprintingEnabled(on);
+}
+
+bool ImageViewer::isOverviewEnabled() const {
+    return m_overview != nullptr;
+}
+
+void ImageViewer::setOverviewEnabled(bool on) {
+    if (!on) {
+        delete m_overview;
+        m_overview = nullptr;
+        return;
+    }
+    if (m_overview)
+        return;
+
+    setupView();
+    m_overview = new Overview(m_view);
+    for (QScrollBar *bar : {m_view->horizontalScrollBar(), m_view->verticalScrollBar()}) {
+        connect(bar, &QScrollBar::valueChanged, m_overview, [this] { m_overview->updateViewport(); });
+        connect(bar, &QScrollBar::rangeChanged, m_overview, [this] { m_overview->updateViewport(); });
+    }
+    connect(m_pixmap, &PixmapItem::imageChanged, m_overview, [this] { updateOverview(); });
+    updateOverview();
+}
+
+void ImageViewer::updateOverview() {
+    if (!m_overview)
+        return;
+    m_overview->setImage(m_pixmap->m_image, m_pixmap->m_source);
+    m_overview->updateViewport();
+}
+
+bool ImageViewer::isLoupeEnabled() const {
+    return m_loupe != nullptr;
+}
+
+void ImageViewer::setLoupeEnabled(bool on) {
+    if (on && !m_loupe)
+        m_loupe = new Loupe(this);
+    else if (!on && m_loupe) {
+        delete m_loupe;
+        m_loupe = nullptr;
+    }
+
+    if (m_loupe_button)
+        m_loupe_button->setChecked(on);
+}
+
+BayerPattern ImageViewer::bayerPattern() const {
+    return m_pixmap->bayerPattern();
+}
+
+void ImageViewer::setBayerPattern(BayerPattern pattern, int bits) {
+    m_pixmap->setBayerPattern(pattern, bits);
+}
+
+bool ImageViewer::isLocalContrastEnabled() const {
+    return m_pixmap->isLocalContrastEnabled();
+}
+
+void ImageViewer::setLocalContrastEnabled(bool on, int regions, double clip_limit) {
+    m_pixmap->setLocalContrastEnabled(on, regions, clip_limit);
+}
+
+bool ImageViewer::setComposite(const QVector<CompositeChannel> &channels) {
+    if (!m_pixmap->setComposite(channels))
+        return false;
+    if (m_fit)
+        zoomFit();
+    emit imageChanged();
+    return true;
+}
+
+QVector<CompositeChannel> ImageViewer::compositeChannels() const {
+    return m_pixmap->compositeChannels();
+}
+
+bool ImageViewer::setCompositeChannel(int index, const CompositeChannel &channel) {
+    if (!m_pixmap->setCompositeChannel(index, channel))
+        return false;
+    updateOverview();
+    return true;
+}
+
+bool ImageViewer::setYuvImage(const YuvFrame &frame) {
+    const int changed = m_pixmap->updateYuvImage(frame);
+    if (changed > 0) {
+        if (m_fit)
+            zoomFit();
+        emit imageChanged();
+    }
+    return changed >= 0;
+}
+
+bool ImageViewer::setCachedImage(const CompressedImageCache &cache, quint64 key) {
+    if (!m_pixmap->setCachedImage(cache, key))
+        return false;
+    if (m_fit)
+        zoomFit();
+    emit imageChanged();
+    return true;
+}
+
+bool ImageViewer::setPyramid(const PyramidCache &cache, const QString &path) {
+    if (!m_pixmap->setPyramid(cache, path))
+        return false;
+    if (m_fit)
+        zoomFit();
+    emit imageChanged();
+    return true;
+}
+
+ImageViewer::Backend ImageViewer::backend() const {
+    return m_backend;
+}
+
+bool ImageViewer::setBackend(Backend backend) {
+    const bool opengl = backend == Backend::OpenGL;
+    bool ok = true;
+
+    if (m_view)
+        ok = m_view->setOpenGLEnabled(opengl);
+#if PAL_IMAGE_VIEWER_OPENGL
+    else if (opengl)
+        ok = detail::isOpenGLAvailable();
+#else
+    else if (opengl)
+        ok = false;
+#endif
+
+    if (ok)
+        m_backend = backend;
+    return ok;
+}
+
 qreal ImageViewer::rotation() const {
     return 180. * rotationRadians() / M_PI;
 }
 
 qreal ImageViewer::rotationRadians() const {
+    if (!m_view)
+        return m_rotation * M_PI / 180.;
+
     auto p10 = m_view->transform().map(QPointF(1., 0.));
     return std::atan2(p10.y(), p10.x());
 }
 
 void ImageViewer::setRotation(qreal angle) {
+    if (!m_view) {
+        // same range as the angle computed from the view transform
+        m_rotation = std::remainder(angle, 360.);
+        if (m_rotation == -180.)
+            m_rotation = 180.;
+        return;
+    }
+
     m_view->rotate(angle - rotation());
     if (m_fit)
         zoomFit();
 }
 
 qreal ImageViewer::scale() const {
+    if (!m_view)
+        return std::pow(2.0, m_zoom_level / 10.0);
+
     auto square = [](qreal value) { return value * value; };
     return std::sqrt(square(m_view->transform().m11()) + square(m_view->transform().m12()));
 }
@@ -225,15 +907,25 @@ qreal ImageViewer::scale() const {
 void ImageViewer::setMatrix() {
     qreal newScale = std::pow(2.0, m_zoom_level / 10.0);
 
-    QTransform mat;
-    mat.scale(newScale, newScale);
-    mat.rotateRadians(rotationRadians());
+    if (m_view) {
+        QTransform mat;
+        mat.scale(newScale, newScale);
+        mat.rotateRadians(rotationRadians());
+        m_view->setTransform(mat);
+    }
+    if (m_overview)
+        m_overview->updateViewport();
 
-    m_view->setTransform(mat);
     emit zoomChanged(scale());
 }
 
 void ImageViewer::zoomFit() {
+    // fitting happens when the view gets created
+    if (!m_view) {
+        m_fit = true;
+        return;
+    }
+
     /* Fit in view by KeepAspectRatioByExpanding does not keep the position
      * find out the current viewport center move back to that position after
      * fitting. It is done here instead of inside the resize event handler
@@ -249,6 +941,8 @@ void ImageViewer::zoomFit() {
 
     if (m_aspect_ratio_mode == Qt::KeepAspectRatioByExpanding)
         m_view->centerOn(cen);
+    if (m_overview)
+        m_overview->updateViewport();
 
     emit zoomChanged(scale());
 }
@@ -272,8 +966,21 @@ void ImageViewer::zoomOut(int level) {
 }
 
 void ImageViewer::mouseAt(int x, int y) {
-    if (m_pixmap->image().valid(x,y)) {
-        QRgb rgb = m_pixmap->image().pixel(x, y);
+    const bool inside = imageBounds(m_pixmap).contains(x, y);
+    if (m_loupe) {
+        if (inside)
+            m_loupe->showAt(m_pixmap, QPoint(x, y), QCursor::pos(), QRect(mapToGlobal(QPoint()), size()));
+        else
+            m_loupe->hide();
+    }
+
+    if (!m_pixel_value)
+        return;
+
+    if (inside) {
+        // cached images have no image of their own
+        const QImage &image = m_pixmap->image();
+        QRgb rgb = image.valid(x, y) ? image.pixel(x, y) : m_pixmap->displayArea(QRect(x, y, 1, 1)).pixel(0, 0);
         auto s = QStringLiteral("[%1, %2] (%3, %4, %5)")
                     .arg(x)
                     .arg(y)
@@ -289,12 +996,14 @@ void ImageViewer::mouseAt(int x, int y) {
 void ImageViewer::updateSceneRect(int w, int h) {
     Q_UNUSED(w)
     Q_UNUSED(h)
-    m_view->scene()->setSceneRect(m_pixmap->boundingRect());
+    if (m_view)
+        m_view->scene()->setSceneRect(m_pixmap->boundingRect());
 }
 
 void ImageViewer::enterEvent(EnterEvent *event) {
     QFrame::enterEvent(event);
     if (m_bar_mode == ToolBarMode::AutoHidden) {
+        makeToolbar();
         m_toolbar->show();
         if (m_fit)
             zoomFit();
@@ -303,7 +1012,9 @@ void ImageViewer::enterEvent(EnterEvent *event) {
 
 void ImageViewer::leaveEvent(QEvent *event) {
     QFrame::leaveEvent(event);
-    if (m_bar_mode == ToolBarMode::AutoHidden) {
+    if (m_loupe)
+        m_loupe->hide();
+    if (m_bar_mode == ToolBarMode::AutoHidden && m_toolbar) {
         m_toolbar->hide();
         if (m_fit)
             zoomFit();
@@ -314,34 +1025,902 @@ void ImageViewer::resizeEvent(QResizeEvent *event) {
     QFrame::resizeEvent(event);
     if (m_fit)
         zoomFit();
+    if (m_overview)
+        m_overview->updateViewport();
 }
 
 void ImageViewer::showEvent(QShowEvent *event) {
+    setupView();
+    updateToolbarVisibility();
     QFrame::showEvent(event);
     if (m_fit)
         zoomFit();
 }
 
 
+// Converts the lines [y0, y1[ of an opaque image to RGB32, with the pixel
+// kernels for the common formats and Qt for the others
+static void convertLines(const QImage &src, uchar *dst, ptrdiff_t dst_bpl, int y0, int y1, const uint32_t *table) {
+    const int w = src.width();
+    auto out = [&](int y) { return reinterpret_cast<uint32_t*>(dst + y * dst_bpl); };
+
+    switch (src.format()) {
+    case QImage::Format_Grayscale8:
+        for (int y = y0; y < y1; ++y)
+            kernels::grayToXrgb(src.constScanLine(y), w, out(y));
+        return;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 13, 0)
+    case QImage::Format_Grayscale16:
+        for (int y = y0; y < y1; ++y)
+            kernels::gray16ToXrgb(src.constScanLine(y), w, out(y));
+        return;
+#endif
+    case QImage::Format_RGB888:
+        for (int y = y0; y < y1; ++y)
+            kernels::rgb888ToXrgb(src.constScanLine(y), w, out(y));
+        return;
+    case QImage::Format_Indexed8:
+        for (int y = y0; y < y1; ++y)
+            kernels::indexedToXrgb(src.constScanLine(y), w, table, out(y));
+        return;
+    default:
+        break;
+    }
+
+    // the band is wrapped without copy, Qt conversions are thread-safe
+    QImage band(src.constScanLine(y0), w, y1 - y0, src.bytesPerLine(), src.format());
+    band.setColorTable(src.colorTable());
+    const QImage converted = band.convertToFormat(QImage::Format_RGB32);
+    for (int y = y0; y < y1; ++y)
+        std::memcpy(out(y), converted.constScanLine(y - y0), size_t(w) * 4);
+}
+
+/*
+ * Opaque images get converted to the native format here rather than in
+ * QPixmap::fromImage(), so that both steps can be accounted for separately,
+ * and so that large images get converted in bands of lines on the thread
+ * pool instead of by the GUI thread alone. Images with an alpha channel are
+ * left to Qt, which detects opaque ones.
+ */
+static QImage toDisplayFormat(const QImage &im) {
+    const auto fmt = im.format();
+    if (fmt == QImage::Format_RGB32 || fmt == QImage::Format_ARGB32_Premultiplied || im.hasAlphaChannel())
+        return im;
+
+    QImage display(im.size(), QImage::Format_RGB32);
+    if (display.isNull())
+        return display;
+
+    // opaque color table, out of range indexes showing black
+    std::vector<uint32_t> table(256, 0xff000000);
+    if (fmt == QImage::Format_Indexed8) {
+        const QVector<QRgb> colors = im.colorTable();
+        for (int i = 0; i < std::min(256, int(colors.size())); ++i)
+            table[size_t(i)] = 0xff000000 | colors[i];
+    }
+
+    // bands of about 256 KiB of pixels
+    const int h = im.height();
+    const int band = std::max(1, 65536 / std::max(1, im.width()));
+    uchar *bits = display.bits();
+    const ptrdiff_t bpl = display.bytesPerLine();
+    detail::parallelFor((h + band - 1) / band, [&](int i) {
+        const int y0 = i * band;
+        convertLines(im, bits, bpl, y0, std::min(h, y0 + band), table.data());
+    });
+    return display;
+}
+
+// Pixels as a raster pixmap holds them, for fingerprinting to write the
+// changed tiles into
+static QImage toDisplay32(const QImage &im) {
+    const QImage display = toDisplayFormat(im);
+    if (display.format() == QImage::Format_RGB32 || display.format() == QImage::Format_ARGB32_Premultiplied)
+        return display;
+    return display.convertToFormat(display.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied
+                                                             : QImage::Format_RGB32);
+}
+
+/*
+ * YUV frames are converted in bands of lines on the thread pool, straight
+ * into the image that becomes the pixmap. Returns a null image for invalid
+ * frames.
+ */
+static QImage yuvToImage(const YuvFrame &frame) {
+    const int w = frame.size.width();
+    const int h = frame.size.height();
+    const int chroma_w = (w + 1) / 2;
+
+    kernels::YuvImage src;
+    src.width = w;
+    src.height = h;
+    for (int i = 0; i < 3; ++i) {
+        src.planes[i] = frame.planes[i];
+        src.strides[i] = frame.strides[i];
+    }
+
+    bool valid = w > 0 && h > 0 && frame.planes[0];
+    switch (frame.layout) {
+    case YuvFrame::Layout::NV12:
+        src.layout = kernels::YuvLayout::NV12;
+        valid = valid && frame.planes[1] && frame.strides[0] >= w && frame.strides[1] >= chroma_w * 2;
+        break;
+    case YuvFrame::Layout::I420:
+        src.layout = kernels::YuvLayout::I420;
+        valid = valid && frame.planes[1] && frame.planes[2] && frame.strides[0] >= w
+             && frame.strides[1] >= chroma_w && frame.strides[2] >= chroma_w;
+        break;
+    case YuvFrame::Layout::YUYV:
+        src.layout = kernels::YuvLayout::YUYV;
+        valid = valid && w % 2 == 0 && frame.strides[0] >= w * 2;
+        break;
+    }
+
+    QImage image;
+    if (valid)
+        image = QImage(frame.size, QImage::Format_RGB32);
+    if (image.isNull())
+        return image;
+
+    const auto matrix = kernels::yuvMatrix(frame.colorSpace == YuvFrame::ColorSpace::BT709, frame.fullRange);
+    uchar *bits = image.bits();
+    const ptrdiff_t bpl = image.bytesPerLine();
+    const int band = 64;
+
+    detail::parallelFor((h + band - 1) / band, [&](int i) {
+        const int y0 = i * band;
+        kernels::yuvToXrgb(src, matrix, y0, std::min(h, y0 + band), bits + y0 * bpl, bpl);
+    });
+    return image;
+}
+
+namespace detail {
+
+// Quarter turn rotated copies of the displayed image, made tile by tile on demand
+struct RotatedTiles {
+    static const int size = 256;
+
+    RotatedTiles()
+        : key(0)
+        , quarter(0)
+        , tiles(256 * 1024)  // KiB
+    {}
+
+    qint64 key;      // cache key of the image the tiles come from
+    int quarter;     // rotation of the tiles
+    QCache<quint32, QPixmap> tiles;
+};
+
+// Tile hashes of the last image, to find out what changed in the next one
+struct Fingerprints {
+    static const int size = 128;
+
+    Fingerprints()
+        : valid(false)
+        , format(QImage::Format_Invalid)
+    {}
+
+    bool valid;       // hashes describe the display image
+    QImage display;   // 32 bits pixels painted instead of a pixmap, only held here
+    QSize image_size;
+    QImage::Format format;
+    QVector<QRgb> colors;
+    std::vector<uint64_t> hashes;
+};
+
+// Rendered tiles of a tile source, at every level painted since the last image
+struct SourceTiles {
+    static const int size = 256;
+    static const int refine_delay = 200;  // ms without new image
+
+    SourceTiles()
+        : refined(false)
+        , tiles(256 * 1024)  // KiB
+    {
+        refine_timer.setSingleShot(true);
+    }
+
+    static quint64 key(int level, int tx, int ty) {
+        return (quint64(level) << 48) | (quint64(ty) << 24) | quint64(tx);
+    }
+
+    bool refined;
+    QTimer refine_timer;
+    QCache<quint64, QPixmap> tiles;
+};
+
+} // namespace detail
+
+// Number of clockwise quarter turns performed by a transform, or -1 if it is
+// not one. Rotations accumulate rounding errors, which are ignored.
+static int quarterTurns(const QTransform &t) {
+    if (t.type() == QTransform::TxProject)
+        return -1;
+
+    const qreal eps = 1e-9 * (std::abs(t.m11()) + std::abs(t.m12()) + std::abs(t.m21()) + std::abs(t.m22()));
+    auto zero = [eps](qreal v) { return std::abs(v) <= eps; };
+
+    if (zero(t.m12()) && zero(t.m21())) {
+        if (t.m11() > 0 && t.m22() > 0)
+            return 0;
+        if (t.m11() < 0 && t.m22() < 0)
+            return 2;
+    }
+    else if (zero(t.m11()) && zero(t.m22())) {
+        if (t.m12() > 0 && t.m21() < 0)
+            return 1;
+        if (t.m12() < 0 && t.m21() > 0)
+            return 3;
+    }
+
+    return -1;
+}
+
+// Maps a w x h image rotated by quarter turns back to the original image
+static QTransform unrotate(int quarter, int w, int h) {
+    switch (quarter) {
+    case 1:  return QTransform(0, -1, 1, 0, 0, h);
+    case 2:  return QTransform(-1, 0, 0, -1, w, h);
+    case 3:  return QTransform(0, 1, -1, 0, w, 0);
+    default: return QTransform();
+    }
+}
+
+// Hashes of the tiles of an image, in rows
+static std::vector<uint64_t> tileHashes(const QImage &im) {
+    const int ts = detail::Fingerprints::size;
+    const int cols = (im.width() + ts - 1) / ts;
+    const int rows = (im.height() + ts - 1) / ts;
+    const int depth = im.depth();
+    const ptrdiff_t bpl = im.bytesPerLine();
+
+    std::vector<uint64_t> hashes(size_t(cols) * size_t(rows));
+    detail::parallelFor(rows, [&](int ty) {
+        const int y = ty * ts;
+        const int h = std::min(ts, im.height() - y);
+        for (int tx = 0; tx < cols; ++tx) {
+            const int x = tx * ts;
+            const int begin = x * depth / 8;
+            const int end = (std::min(x + ts, im.width()) * depth + 7) / 8;
+            hashes[size_t(ty) * size_t(cols) + size_t(tx)] =
+                kernels::hashBlock(im.constBits() + y * bpl + begin, bpl, end - begin, h);
+        }
+    });
+    return hashes;
+}
+
 PixmapItem::PixmapItem(QGraphicsItem *parent) :
-    QObject(), QGraphicsPixmapItem(parent)
+    QObject(), QGraphicsPixmapItem(parent), m_stats(new detail::StatsCounters),
+    m_rotated(new detail::RotatedTiles), m_bayer(BayerPattern::None), m_bayer_bits(16),
+    m_clahe_regions(0), m_clahe_clip(2.0)
 {
     setAcceptHoverEvents(true);
+    setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);  // for the exposed rect
+}
+
+PixmapItem::~PixmapItem() = default;
+
+bool PixmapItem::isStatsEnabled() const {
+    return m_stats->isEnabled();
+}
+
+void PixmapItem::setStatsEnabled(bool on) {
+    m_stats->setEnabled(on);
+    updateMemoryUsage();
+}
+
+RenderStats PixmapItem::renderStats() const {
+    return m_stats->snapshot();
+}
+
+void PixmapItem::resetStats() {
+    m_stats->reset();
+}
+
+void PixmapItem::updateMemoryUsage() {
+    if (!m_stats->isEnabled())
+        return;
+
+    const QPixmap pm = pixmap();
+    qint64 bytes = qint64(m_image.bytesPerLine()) * m_image.height();
+    bytes += qint64(pm.width()) * pm.height() * pm.depth() / 8;
+    if (m_fingerprints)
+        bytes += qint64(m_fingerprints->display.bytesPerLine()) * m_fingerprints->display.height();
+    for (int i = 1; i < m_channels.size(); ++i)
+        bytes += qint64(m_channels[i].image.bytesPerLine()) * m_channels[i].image.height();
+    m_stats->memory_bytes = bytes;
+    if (m_source_tiles)
+        m_stats->tile_bytes = qint64(m_source_tiles->tiles.totalCost()) * 1024;
+}
+
+bool PixmapItem::isFingerprintingEnabled() const {
+    return m_fingerprints != nullptr;
+}
+
+void PixmapItem::setFingerprintingEnabled(bool on) {
+    // the hashes of the current image are only known from the next one on
+    if (on) {
+        if (!m_fingerprints)
+            m_fingerprints.reset(new detail::Fingerprints);
+        return;
+    }
+
+    // the image displayed without a pixmap gets one back
+    const bool displayed = m_fingerprints && !m_fingerprints->display.isNull();
+    m_fingerprints.reset();
+    if (displayed)
+        updateImage(m_image);
+}
+
+BayerPattern PixmapItem::bayerPattern() const {
+    return m_bayer;
+}
+
+void PixmapItem::setBayerPattern(BayerPattern pattern, int bits) {
+    if (pattern == m_bayer && bits == m_bayer_bits)
+        return;
+
+    m_bayer = pattern;
+    m_bayer_bits = bits;
+
+    // the current image gets displayed again, identical as it is
+    if (!m_image.isNull() && m_channels.isEmpty()) {
+        if (m_fingerprints)
+            m_fingerprints->valid = false;
+        updateImage(m_image);
+    }
+}
+
+bool PixmapItem::isLocalContrastEnabled() const {
+    return m_clahe_regions > 0;
+}
+
+void PixmapItem::setLocalContrastEnabled(bool on, int regions, double clip_limit) {
+    regions = on ? std::max(1, regions) : 0;
+    if (regions == m_clahe_regions && (!on || clip_limit == m_clahe_clip))
+        return;
+
+    m_clahe_regions = regions;
+    m_clahe_clip = clip_limit;
+
+    if (!m_image.isNull() && m_channels.isEmpty()) {
+        if (m_fingerprints)
+            m_fingerprints->valid = false;
+        updateImage(m_image);
+    }
+}
+
+QImage PixmapItem::displayArea(const QRect &rect) const {
+    const QRect area = rect & QRect(QPoint(), m_source ? m_source->size() : m_image.size());
+    if (area.isEmpty())
+        return QImage();
+    if (m_source)
+        return m_source->render(area, 0, m_source_tiles->refined);
+    return toDisplayFormat(m_image.copy(area));
+}
+
+QRectF PixmapItem::boundingRect() const {
+    if (m_fingerprints && !m_fingerprints->display.isNull())
+        return QRectF(offset(), QSizeF(m_fingerprints->display.size()));
+    if (!m_source)
+        return QGraphicsPixmapItem::boundingRect();
+    return QRectF(offset(), QSizeF(m_source->size()));
+}
+
+QPainterPath PixmapItem::shape() const {
+    if (!m_source && (!m_fingerprints || m_fingerprints->display.isNull()))
+        return QGraphicsPixmapItem::shape();
+    QPainterPath path;
+    path.addRect(boundingRect());
+    return path;
+}
+
+/*
+ * Images rendered by a tile source have no pixmap. Sources get replaced with
+ * every image, their rendered tiles with them.
+ */
+void PixmapItem::setSource(std::shared_ptr<detail::TileSource> source) {
+    if (!source || !m_source || source->size() != m_source->size())
+        prepareGeometryChange();
+
+    if (source && !m_source) {
+        setPixmap(QPixmap());
+        if (m_fingerprints) {
+            m_fingerprints->valid = false;
+            m_fingerprints->display = QImage();
+        }
+    }
+
+    if (!m_source_tiles) {
+        m_source_tiles.reset(new detail::SourceTiles);
+        connect(&m_source_tiles->refine_timer, &QTimer::timeout, this, [this] {
+            // only full resolution tiles get refined
+            auto &cache = *m_source_tiles;
+            cache.refined = true;
+            for (quint64 key : cache.tiles.keys())
+                if ((key >> 48) == 0)
+                    cache.tiles.remove(key);
+            update();
+        });
+    }
+
+    auto &cache = *m_source_tiles;
+    m_source = std::move(source);
+    cache.tiles.clear();
+    cache.refined = false;
+    if (m_source && m_source->hasRefinement())
+        cache.refine_timer.start(detail::SourceTiles::refine_delay);
+    else
+        cache.refine_timer.stop();
+    update();
 }
 
 void PixmapItem::setImage(QImage im) {
+    updateImage(std::move(im));
+}
+
+bool PixmapItem::setComposite(const QVector<CompositeChannel> &channels) {
+    if (!detail::CompositeSource::accepts(channels))
+        return false;
+
+    const QSize previous = m_image.size();
+    m_channels = channels;
+    m_image = channels.first().image;
+    setSource(std::make_shared<detail::CompositeSource>(channels));
+
+    if (m_stats->isEnabled())
+        m_stats->frameSubmitted();
+    updateMemoryUsage();
+    if (m_image.size() != previous)
+        emit sizeChanged(m_image.width(), m_image.height());
+    emit imageChanged(m_image);
+    return true;
+}
+
+bool PixmapItem::setCachedImage(const CompressedImageCache &cache, quint64 key) {
+    std::shared_ptr<detail::TileSource> source = cache.source(key);
+    if (!source)
+        return false;
+    showSource(std::move(source));
+    return true;
+}
+
+bool PixmapItem::setPyramid(const PyramidCache &cache, const QString &path) {
+    std::shared_ptr<detail::TileSource> source = cache.source(path);
+    if (!source)
+        return false;
+    showSource(std::move(source));
+    return true;
+}
+
+// Display a source that is the image itself, with no QImage behind it
+void PixmapItem::showSource(std::shared_ptr<detail::TileSource> source) {
+    const QSize previous = m_source ? m_source->size() : m_image.size();
+    m_channels.clear();
+    m_image = QImage();
+    setSource(std::move(source));
+
+    if (m_stats->isEnabled())
+        m_stats->frameSubmitted();
+    updateMemoryUsage();
+    if (m_source->size() != previous)
+        emit sizeChanged(m_source->size().width(), m_source->size().height());
+    emit imageChanged(m_image);
+}
+
+QVector<CompositeChannel> PixmapItem::compositeChannels() const {
+    return m_channels;
+}
+
+// Channels share their samples with the previous source, only the visible
+// tiles get blended again
+bool PixmapItem::setCompositeChannel(int index, const CompositeChannel &channel) {
+    if (index < 0 || index >= m_channels.size())
+        return false;
+
+    QVector<CompositeChannel> channels = m_channels;
+    channels[index] = channel;
+    if (!detail::CompositeSource::accepts(channels))
+        return false;
+
+    m_channels = channels;
+    if (index == 0)
+        m_image = channel.image;
+    setSource(std::make_shared<detail::CompositeSource>(m_channels));
+    return true;
+}
+
+bool PixmapItem::setYuvImage(const YuvFrame &frame) {
+    return updateYuvImage(frame) >= 0;
+}
+
+// Returns 1 if the frame got displayed, 0 if it was identical to the
+// displayed one, -1 if it is not valid
+int PixmapItem::updateYuvImage(const YuvFrame &frame) {
+    QElapsedTimer clock;
+    clock.start();
+    QImage im = yuvToImage(frame);
+    if (im.isNull())
+        return -1;
+    return updateImage(std::move(im), clock.nsecsElapsed()) ? 1 : 0;
+}
+
+/*
+ * Returns false if the image was identical to the displayed one, and skipped.
+ * conversion_ns is the duration of a conversion done upstream, which the
+ * display format step then completes.
+ */
+bool PixmapItem::updateImage(QImage im, qint64 conversion_ns) {
     if (im.isNull()) {
         m_image.fill(Qt::white);
         im = m_image.copy();
     }
     std::swap(m_image, im);
+    m_channels.clear();
+
+    // raw and equalized images are rendered tile by tile when painted
+    std::shared_ptr<detail::TileSource> source;
+    if (m_bayer != BayerPattern::None && detail::BayerSource::accepts(m_image)) {
+        source = std::make_shared<detail::BayerSource>(m_image, m_bayer, m_bayer_bits);
+    }
+    else if (m_clahe_regions > 0) {
+        detail::ScopedTimer timer(*m_stats, m_stats->conversion_ns);
+        source = std::make_shared<detail::ClaheSource>(toDisplayFormat(m_image), m_clahe_regions, m_clahe_clip);
+    }
+
+    if (source || m_source)
+        setSource(std::move(source));
+
+    if (m_source) {
+        if (m_stats->isEnabled())
+            m_stats->frameSubmitted();
+        updateMemoryUsage();
+        if (m_image.size() != im.size())
+            emit sizeChanged(m_image.width(), m_image.height());
+        emit imageChanged(m_image);
+        return true;
+    }
+
+    if (m_fingerprints) {
+        const int changed = updateChangedTiles(m_image);
+        if (changed == 0) {
+            if (m_stats->isEnabled())
+                m_stats->frames_unchanged.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        if (changed > 0) {
+            emit imageChanged(m_image);
+            return true;
+        }
+    }
+
+    if (m_stats->isEnabled())
+        m_stats->frameSubmitted();
 
-    setPixmap(QPixmap::fromImage(m_image));
+    QImage display;
+    {
+        detail::ScopedTimer timer(*m_stats, m_stats->conversion_ns);
+        display = m_fingerprints ? toDisplay32(m_image) : toDisplayFormat(m_image);
+    }
+    if (conversion_ns >= 0 && m_stats->isEnabled())
+        m_stats->conversion_ns.fetch_add(conversion_ns, std::memory_order_relaxed);
+    if (m_fingerprints) {
+        // painted from the display image, which changed tiles get written into,
+        // and which must not share the pixels of the frame for that
+        prepareGeometryChange();
+        m_fingerprints->display = std::move(display);
+        if (!m_fingerprints->display.isDetached())
+            m_fingerprints->display = m_fingerprints->display.copy();
+        if (!pixmap().isNull())
+            setPixmap(QPixmap());
+        update();
+    }
+    else {
+        detail::ScopedTimer timer(*m_stats, m_stats->upload_ns);
+        setPixmap(QPixmap::fromImage(std::move(display)));
+    }
+    updateMemoryUsage();
 
     if (m_image.size() != im.size())
         emit sizeChanged(m_image.width(), m_image.height());
 
     emit imageChanged(m_image);
+    return true;
+}
+
+/*
+ * Compares the tile hashes of a new image to the ones of the displayed one,
+ * and converts the changed tiles in place into the display image, only
+ * repainting them. Caches built from the previous display image only drop
+ * their tiles that changed.
+ *
+ * Returns the number of tiles updated, or -1 if the whole image needs to be.
+ */
+int PixmapItem::updateChangedTiles(const QImage &im) {
+    auto &fp = *m_fingerprints;
+    std::vector<uint64_t> hashes;
+    {
+        detail::ScopedTimer timer(*m_stats, m_stats->conversion_ns);
+        hashes = tileHashes(im);
+    }
+
+    const bool comparable = fp.valid && fp.display.size() == im.size() && im.size() == fp.image_size
+                         && im.format() == fp.format && im.colorTable() == fp.colors;
+    hashes.swap(fp.hashes);
+    fp.valid = true;
+    fp.image_size = im.size();
+    fp.format = im.format();
+    fp.colors = im.colorTable();
+    if (!comparable)
+        return -1;
+
+    const int ts = detail::Fingerprints::size;
+    const int cols = (im.width() + ts - 1) / ts;
+    const int rows = (im.height() + ts - 1) / ts;
+    const QRect bounds = im.rect();
+    int changed = 0;
+    QVector<QRect> spans;
+
+    // changed tiles of a row are merged into spans, to limit the invalidated areas
+    {
+        detail::ScopedTimer timer(*m_stats, m_stats->conversion_ns);
+        for (int ty = 0; ty < rows; ++ty) {
+            int span_start = -1;
+            for (int tx = 0; tx <= cols; ++tx) {
+                const size_t i = size_t(ty) * size_t(cols) + size_t(tx);
+                if (tx < cols && hashes[i] != fp.hashes[i]) {
+                    ++changed;
+                    if (span_start < 0)
+                        span_start = tx;
+                }
+                else if (span_start >= 0) {
+                    spans.append(QRect(span_start * ts, ty * ts, (tx - span_start) * ts, ts) & bounds);
+                    span_start = -1;
+                }
+            }
+        }
+    }
+
+    if (changed > 0) {
+        // the display image is not shared, it gets written in place
+        const qint64 previous = fp.display.cacheKey();
+        {
+            detail::ScopedTimer timer(*m_stats, m_stats->conversion_ns);
+            uchar *bits = fp.display.bits();
+            const ptrdiff_t bpl = fp.display.bytesPerLine();
+            detail::parallelFor(int(spans.size()), [&](int i) {
+                const QRect &r = spans.at(i);
+                const QImage tile = toDisplay32(im.copy(r)).convertToFormat(fp.display.format());
+                for (int y = 0; y < r.height(); ++y)
+                    std::memcpy(bits + (r.y() + y) * bpl + r.x() * 4, tile.constScanLine(y), size_t(r.width()) * 4);
+            });
+        }
+
+        // writing changed the cache key
+        const qint64 key = fp.display.cacheKey();
+        if (m_rotated->key == previous) {
+            const int rs = detail::RotatedTiles::size;
+            for (const QRect &r : spans) {
+                for (int ry = r.top() / rs; ry <= r.bottom() / rs; ++ry)
+                    for (int rx = r.left() / rs; rx <= r.right() / rs; ++rx)
+                        m_rotated->tiles.remove((quint32(ry) << 16) | quint32(rx));
+            }
+            m_rotated->key = key;
+        }
+#if PAL_IMAGE_VIEWER_OPENGL
+        if (m_gl) {
+            for (const QRect &r : spans)
+                m_gl->invalidate(r);
+            m_gl->setImageKey(previous, key);
+        }
+#endif
+        for (const QRect &r : spans)
+            update(QRectF(r).translated(offset()));
+    }
+
+    if (m_stats->isEnabled()) {
+        m_stats->tiles_updated.fetch_add(quint64(changed), std::memory_order_relaxed);
+        m_stats->tiles_unchanged.fetch_add(quint64(cols * rows - changed), std::memory_order_relaxed);
+        if (changed)
+            m_stats->frameSubmitted();
+    }
+    return changed;
+}
+
+void PixmapItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) {
+    if (!paintSource(painter, option) && !paintOpenGL(painter, option, widget) && !paintRotated(painter, option)
+        && !paintDisplay(painter))
+        QGraphicsPixmapItem::paint(painter, option, widget);
+    if (m_stats->isEnabled())
+        m_stats->framePainted();
+}
+
+/*
+ * Tile sources are rendered at the level matching the scale of the view, so
+ * that the work is bounded by the size of the viewport. Visible tiles missing
+ * from the cache are rendered in parallel, and drawn scaled back up.
+ */
+bool PixmapItem::paintSource(QPainter *painter, const QStyleOptionGraphicsItem *option) {
+    if (!m_source)
+        return false;
+
+    auto &cache = *m_source_tiles;
+    const detail::TileSource &source = *m_source;
+    const QSize size = source.size();
+
+    // device pixels per image pixel, the deepest level still showing them all
+    const qreal scale = std::sqrt(std::abs(painter->worldTransform().determinant()))
+                      * painter->device()->devicePixelRatioF();
+    int level = 0;
+    while (level < 16 && scale * (2 << level) <= 1.0 && (size.width() >> (level + 1)) > 0
+           && (size.height() >> (level + 1)) > 0)
+        ++level;
+
+    const int f = 1 << level;
+    const int ts = detail::SourceTiles::size;
+    const QRect bounds(QPoint(), source.levelSize(level));
+    const QRectF exposed = (option ? option->exposedRect : boundingRect()).translated(-offset());
+    const QRect visible = QRectF(exposed.x() / f, exposed.y() / f, exposed.width() / f, exposed.height() / f)
+                          .toAlignedRect() & bounds;
+
+    // tiles are held locally, inserting new ones may evict others from the cache
+    struct Tile {
+        quint64 key;
+        QRect rect;
+        QImage image;
+        QPixmap pixmap;
+    };
+    std::vector<Tile> tiles;
+    std::vector<int> missing;
+    for (int ty = visible.top() / ts; !visible.isEmpty() && ty <= visible.bottom() / ts; ++ty) {
+        for (int tx = visible.left() / ts; tx <= visible.right() / ts; ++tx) {
+            const quint64 key = detail::SourceTiles::key(level, tx, ty);
+            const QPixmap *cached = cache.tiles.object(key);
+            if (!cached)
+                missing.push_back(int(tiles.size()));
+            tiles.push_back({key, QRect(tx * ts, ty * ts, ts, ts) & bounds, QImage(),
+                             cached ? *cached : QPixmap()});
+        }
+    }
+
+    if (!missing.empty()) {
+        {
+            detail::ScopedTimer timer(*m_stats, m_stats->conversion_ns);
+            const bool refined = cache.refined;
+            detail::parallelFor(int(missing.size()), [&](int i) {
+                Tile &tile = tiles[size_t(missing[size_t(i)])];
+                tile.image = source.render(tile.rect, level, refined);
+            });
+        }
+        detail::ScopedTimer timer(*m_stats, m_stats->upload_ns);
+        for (int i : missing) {
+            Tile &tile = tiles[size_t(i)];
+            tile.pixmap = QPixmap::fromImage(std::move(tile.image));
+            const int cost = int(qint64(tile.pixmap.width()) * tile.pixmap.height() * 4 / 1024);
+            cache.tiles.insert(tile.key, new QPixmap(tile.pixmap), std::max(1, cost));
+        }
+        m_stats->tile_bytes = qint64(cache.tiles.totalCost()) * 1024;
+    }
+
+    // the last level pixels may stick out of the image
+    const QRectF image_rect(QPointF(), QSizeF(size));
+    painter->setRenderHint(QPainter::SmoothPixmapTransform, transformationMode() == Qt::SmoothTransformation);
+    for (const Tile &tile : tiles) {
+        const QRect &r = tile.rect;
+        const QRectF target = QRectF(r.x() * f, r.y() * f, r.width() * f, r.height() * f) & image_rect;
+        painter->drawPixmap(target.translated(offset()), tile.pixmap,
+                            QRectF(0, 0, target.width() / f, target.height() / f));
+    }
+    return true;
+}
+
+/*
+ * Pixels displayed without a tile source. Raster pixmaps wrap an image, which
+ * toImage() returns without copying.
+ */
+QImage PixmapItem::displayImage() const {
+    if (m_fingerprints && !m_fingerprints->display.isNull())
+        return m_fingerprints->display;
+    return pixmap().toImage();
+}
+
+// Fingerprinted frames are painted from the display image, as the pixmap would be
+bool PixmapItem::paintDisplay(QPainter *painter) {
+    if (!m_fingerprints || m_fingerprints->display.isNull())
+        return false;
+    painter->setRenderHint(QPainter::SmoothPixmapTransform, transformationMode() == Qt::SmoothTransformation);
+    painter->drawImage(offset(), m_fingerprints->display);
+    return true;
+}
+
+// In an OpenGL viewport, the image is drawn from textures kept on the GPU
+bool PixmapItem::paintOpenGL(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) {
+#if PAL_IMAGE_VIEWER_OPENGL
+    if (!painter->paintEngine() || painter->paintEngine()->type() != QPaintEngine::OpenGL2)
+        return false;
+
+    if (!m_gl)
+        m_gl.reset(new detail::GLTileRenderer);
+
+    const QRectF exposed = option ? option->exposedRect : boundingRect();
+    const bool done = m_gl->paint(painter, widget, displayImage(), exposed.translated(-offset()), offset(),
+                                  transformationMode() == Qt::SmoothTransformation);
+    m_stats->texture_bytes = m_gl->memoryUsage();
+    return done;
+#else
+    Q_UNUSED(painter)
+    Q_UNUSED(option)
+    Q_UNUSED(widget)
+    return false;
+#endif
+}
+
+/*
+ * Views rotated by quarter turns are drawn from rotated copies of the visible
+ * tiles, which turns every paint into an axis aligned blit instead of going
+ * through the general affine rasterizer. Tiles are independent, which only
+ * works without smoothing nor antialiasing, that would blend their borders.
+ */
+bool PixmapItem::paintRotated(QPainter *painter, const QStyleOptionGraphicsItem *option) {
+    const QTransform world = painter->worldTransform();
+    const int quarter = quarterTurns(world);
+    if (quarter <= 0 || transformationMode() != Qt::FastTransformation
+        || painter->testRenderHint(QPainter::Antialiasing))
+        return false;
+
+    const QImage image = displayImage();
+    if (image.isNull() || image.depth() != 32 || image.devicePixelRatio() != 1.0)
+        return false;
+
+    auto &cache = *m_rotated;
+    if (cache.key != image.cacheKey() || cache.quarter != quarter) {
+        cache.tiles.clear();
+        cache.key = image.cacheKey();
+        cache.quarter = quarter;
+    }
+
+    const int w = image.width();
+    const int h = image.height();
+    const int ts = detail::RotatedTiles::size;
+    const QRect bounds(0, 0, w, h);
+    const QRect visible = option
+        ? option->exposedRect.translated(-offset()).toAlignedRect() & bounds
+        : bounds;
+
+    // rotated tile coordinates to device, axis aligned once the rounding
+    // errors of the rotation are dropped
+    const QTransform to_item = unrotate(quarter, w, h) * QTransform::fromTranslate(offset().x(), offset().y());
+    const QTransform t = to_item * world;
+    const QTransform to_rotated = unrotate(quarter, w, h).inverted();
+
+    painter->setWorldTransform(QTransform(t.m11(), 0, 0, t.m22(), t.dx(), t.dy()));
+
+    for (int ty = visible.top() / ts; !visible.isEmpty() && ty <= visible.bottom() / ts; ++ty) {
+        for (int tx = visible.left() / ts; tx <= visible.right() / ts; ++tx) {
+            const QRect src = QRect(tx * ts, ty * ts, ts, ts) & bounds;
+            const quint32 key = (quint32(ty) << 16) | quint32(tx);
+
+            QPixmap *tile = cache.tiles.object(key);
+            if (!tile) {
+                const QSize size = quarter % 2 ? src.size().transposed() : src.size();
+                QImage rotated(size, image.format());
+                const ptrdiff_t bpl = image.bytesPerLine();
+                kernels::rotate32(image.constBits() + src.y() * bpl + src.x() * 4, bpl,
+                                  src.width(), src.height(),
+                                  rotated.bits(), rotated.bytesPerLine(), quarter);
+
+                tile = new QPixmap(QPixmap::fromImage(std::move(rotated)));
+                const int cost = int(qint64(size.width()) * size.height() * 4 / 1024);
+                cache.tiles.insert(key, tile, std::max(1, cost));
+                m_stats->tile_bytes = qint64(cache.tiles.totalCost()) * 1024;
+            }
+
+            painter->drawPixmap(to_rotated.mapRect(QRectF(src)).topLeft(), *tile);
+        }
+    }
+
+    painter->setWorldTransform(world);
+    return true;
 }
 
 void PixmapItem::mouseDoubleClickEvent(QGraphicsSceneMouseEvent *event) {
@@ -0,0 +1,1053 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include "kernels.h"
+
+#if !defined(PAL_KERNELS_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define PAL_KERNELS_SSE2
+#include <emmintrin.h>
+#ifdef __SSSE3__
+#define PAL_KERNELS_SSSE3
+#include <tmmintrin.h>
+#endif
+#endif
+
+namespace pal {
+namespace kernels {
+
+namespace {
+
+// Rotations go through square blocks small enough for the source and
+// destination lines of a block to stay in the L1 cache
+const int rotate_block = 64;
+
+inline const uint32_t *line32(const uint8_t *base, ptrdiff_t stride, int y) {
+    return reinterpret_cast<const uint32_t*>(base + y * stride);
+}
+
+inline uint32_t *line32(uint8_t *base, ptrdiff_t stride, int y) {
+    return reinterpret_cast<uint32_t*>(base + y * stride);
+}
+
+#ifdef PAL_KERNELS_SSE2
+// transposes a 4x4 block of 32 bits values held in 4 registers
+inline void transpose4(__m128i &r0, __m128i &r1, __m128i &r2, __m128i &r3) {
+    const __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+    const __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+    const __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+    const __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+    r0 = _mm_unpacklo_epi64(t0, t1);
+    r1 = _mm_unpackhi_epi64(t0, t1);
+    r2 = _mm_unpacklo_epi64(t2, t3);
+    r3 = _mm_unpackhi_epi64(t2, t3);
+}
+
+inline __m128i reverse4(__m128i v) {
+    return _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+}
+#endif
+
+/*
+ * Rotates the source area [x0, x1[ x [y0, y1[ by a quarter turn:
+ * - clockwise:         src(x, y) -> dst(h - 1 - y, x)
+ * - counter clockwise: src(x, y) -> dst(y, w - 1 - x)
+ */
+void rotateBlock(const uint8_t *src, ptrdiff_t ss, int w, int h,
+                 uint8_t *dst, ptrdiff_t ds,
+                 int x0, int y0, int x1, int y1, bool clockwise)
+{
+    int y = y0;
+
+#ifdef PAL_KERNELS_SSE2
+    for (; y + 4 <= y1; y += 4) {
+        int x = x0;
+        for (; x + 4 <= x1; x += 4) {
+            __m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(line32(src, ss, y) + x));
+            __m128i r1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(line32(src, ss, y + 1) + x));
+            __m128i r2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(line32(src, ss, y + 2) + x));
+            __m128i r3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(line32(src, ss, y + 3) + x));
+            transpose4(r0, r1, r2, r3);
+
+            // rN now holds the source column x + N, top to bottom
+            if (clockwise) {
+                const int dx = h - 4 - y;
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(line32(dst, ds, x) + dx), reverse4(r0));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(line32(dst, ds, x + 1) + dx), reverse4(r1));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(line32(dst, ds, x + 2) + dx), reverse4(r2));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(line32(dst, ds, x + 3) + dx), reverse4(r3));
+            }
+            else {
+                const int dy = w - 1 - x;
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(line32(dst, ds, dy) + y), r0);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(line32(dst, ds, dy - 1) + y), r1);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(line32(dst, ds, dy - 2) + y), r2);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(line32(dst, ds, dy - 3) + y), r3);
+            }
+        }
+
+        // right border of the 4 lines band
+        for (int yy = y; yy < y + 4; ++yy) {
+            const uint32_t *s = line32(src, ss, yy);
+            for (int xx = x; xx < x1; ++xx) {
+                if (clockwise)
+                    line32(dst, ds, xx)[h - 1 - yy] = s[xx];
+                else
+                    line32(dst, ds, w - 1 - xx)[yy] = s[xx];
+            }
+        }
+    }
+#endif
+
+    // bottom border, or everything without SIMD
+    for (; y < y1; ++y) {
+        const uint32_t *s = line32(src, ss, y);
+        for (int x = x0; x < x1; ++x) {
+            if (clockwise)
+                line32(dst, ds, x)[h - 1 - y] = s[x];
+            else
+                line32(dst, ds, w - 1 - x)[y] = s[x];
+        }
+    }
+}
+
+void rotateHalfTurn(const uint8_t *src, ptrdiff_t ss, int w, int h, uint8_t *dst, ptrdiff_t ds) {
+    for (int y = 0; y < h; ++y) {
+        const uint32_t *s = line32(src, ss, y);
+        uint32_t *d = line32(dst, ds, h - 1 - y);
+        int x = 0;
+#ifdef PAL_KERNELS_SSE2
+        for (; x + 4 <= w; x += 4) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + x));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(d + w - 4 - x), reverse4(v));
+        }
+#endif
+        for (; x < w; ++x)
+            d[w - 1 - x] = s[x];
+    }
+}
+
+/*
+ * Block hash, in the spirit of XXH3: 16 bytes chunks are mixed into two 64
+ * bits accumulators with a 32x32 bits multiply, and the accumulators get
+ * scrambled every 64 bytes and at the end of every line, so that the order
+ * of chunks and lines matters. The SSE2 and scalar paths compute the same
+ * values.
+ */
+const uint64_t hash_keys[10] = {
+    0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL, 0xdb979083e96dd4deULL, 0x1f67b3b7a4a44072ULL,
+    0x78e5c0cc4ee679cbULL, 0x2172ffcc7dd05a82ULL, 0x8e2443f7744608b8ULL, 0x4c263a81e69035e0ULL,
+    0xcb00c391bb52283cULL, 0xa32e531b8b65d088ULL,
+};
+const uint64_t hash_prime32 = 0x9e3779b1ULL;
+const int hash_block = 64;
+
+inline uint64_t load64(const uint8_t *p) {
+    uint64_t v;
+    std::memcpy(&v, p, 8);
+    return v;
+}
+
+inline uint64_t avalanche(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+#ifdef PAL_KERNELS_SSE2
+struct HashState {
+    __m128i acc = _mm_set_epi64x(0x165667b19e3779f9LL, 0x27d4eb2f165667c5LL);
+
+    void chunk(const uint8_t *p, int key) {
+        const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const __m128i k = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hash_keys + key));
+        const __m128i dk = _mm_xor_si128(data, k);
+        const __m128i product = _mm_mul_epu32(dk, _mm_shuffle_epi32(dk, _MM_SHUFFLE(0, 3, 0, 1)));
+        const __m128i swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+        acc = _mm_add_epi64(acc, _mm_add_epi64(product, swapped));
+    }
+
+    void scramble() {
+        const __m128i k = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hash_keys + 8));
+        const __m128i prime = _mm_set1_epi32(int(hash_prime32));
+        __m128i a = _mm_xor_si128(_mm_xor_si128(acc, _mm_srli_epi64(acc, 47)), k);
+        const __m128i lo = _mm_mul_epu32(a, prime);
+        const __m128i hi = _mm_mul_epu32(_mm_srli_epi64(a, 32), prime);
+        acc = _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+    }
+
+    uint64_t lane(int i) const {
+        alignas(16) uint64_t v[2];
+        _mm_store_si128(reinterpret_cast<__m128i*>(v), acc);
+        return v[i];
+    }
+};
+#else
+struct HashState {
+    uint64_t acc[2] = {0x27d4eb2f165667c5ULL, 0x165667b19e3779f9ULL};
+
+    void chunk(const uint8_t *p, int key) {
+        const uint64_t d0 = load64(p);
+        const uint64_t d1 = load64(p + 8);
+        const uint64_t k0 = d0 ^ hash_keys[key];
+        const uint64_t k1 = d1 ^ hash_keys[key + 1];
+        acc[0] += (k0 & 0xffffffffULL) * (k0 >> 32) + d1;
+        acc[1] += (k1 & 0xffffffffULL) * (k1 >> 32) + d0;
+    }
+
+    void scramble() {
+        for (int i = 0; i < 2; ++i)
+            acc[i] = (acc[i] ^ (acc[i] >> 47) ^ hash_keys[8 + i]) * hash_prime32;
+    }
+
+    uint64_t lane(int i) const {
+        return acc[i];
+    }
+};
+#endif
+
+
+// per byte average rounding up, as _mm_avg_epu8
+inline uint32_t average4(uint32_t a, uint32_t b) {
+    return (a | b) - (((a ^ b) & 0xfefefefeU) >> 1);
+}
+
+inline uint8_t average(uint8_t a, uint8_t b) {
+    return uint8_t((a + b + 1) >> 1);
+}
+
+inline uint32_t xrgb(int r, int g, int b) {
+    return 0xff000000U | (uint32_t(r) << 16) | (uint32_t(g) << 8) | uint32_t(b);
+}
+
+inline uint8_t clamp8(int v) {
+    return uint8_t(std::max(0, std::min(v, 255)));
+}
+
+#ifdef PAL_KERNELS_SSE2
+inline __m128i load128(const void *p) {
+    return _mm_loadu_si128(static_cast<const __m128i*>(p));
+}
+
+// a where the mask is set, b elsewhere
+inline __m128i select(__m128i mask, __m128i a, __m128i b) {
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// interleaves 16 pixels worth of channels into 0xffRRGGBB pixels
+inline void storeXrgb(uint32_t *dst, __m128i r, __m128i g, __m128i b) {
+    const __m128i alpha = _mm_set1_epi8(-1);
+    const __m128i bg_lo = _mm_unpacklo_epi8(b, g);
+    const __m128i bg_hi = _mm_unpackhi_epi8(b, g);
+    const __m128i ra_lo = _mm_unpacklo_epi8(r, alpha);
+    const __m128i ra_hi = _mm_unpackhi_epi8(r, alpha);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_unpacklo_epi16(bg_lo, ra_lo));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4), _mm_unpackhi_epi16(bg_lo, ra_lo));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 8), _mm_unpacklo_epi16(bg_hi, ra_hi));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 12), _mm_unpackhi_epi16(bg_hi, ra_hi));
+}
+#endif
+
+/*
+ * Bayer mosaics are mirrored at their borders without repeating the border
+ * samples, which keeps the color of every position.
+ */
+inline int mirror(int i, int n) {
+    if (n == 1)
+        return 0;
+    while (i < 0 || i >= n)
+        i = i < 0 ? -i : 2 * n - 2 - i;
+    return i;
+}
+
+// position of the red samples in the 2x2 cells, blue ones sit diagonally
+inline void redPosition(Bayer pattern, int &rx, int &ry) {
+    rx = (pattern == Bayer::BGGR || pattern == Bayer::GRBG) ? 1 : 0;
+    ry = (pattern == Bayer::BGGR || pattern == Bayer::GBRG) ? 1 : 0;
+}
+
+inline uint8_t narrow(uint16_t v, int shift) {
+    return uint8_t(std::min(v >> shift, 255));
+}
+
+void narrowLine(const uint8_t *src, int count, int shift, uint8_t *dst) {
+    const uint16_t *s = reinterpret_cast<const uint16_t*>(src);
+    int i = 0;
+#ifdef PAL_KERNELS_SSE2
+    // once shifted, samples are positive 16 bits integers for packus
+    if (shift > 0) {
+        const __m128i sh = _mm_cvtsi32_si128(shift);
+        for (; i + 16 <= count; i += 16) {
+            const __m128i a = _mm_srl_epi16(load128(s + i), sh);
+            const __m128i b = _mm_srl_epi16(load128(s + i + 8), sh);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(a, b));
+        }
+    }
+#endif
+    for (; i < count; ++i)
+        dst[i] = narrow(s[i], shift);
+}
+
+/*
+ * Gathers the samples of the window [x - border, x + w + border[ x
+ * [y - border, y + h + border[ of a mosaic as 8 bits values, so that kernels
+ * read neighbours without bound checks.
+ */
+std::vector<uint8_t> gatherWindow(const BayerMosaic &m, int x, int y, int w, int h, int border, int &stride) {
+    const int pw = w + 2 * border;
+    const int ph = h + 2 * border;
+    const int x0 = x - border;
+    stride = pw;
+    std::vector<uint8_t> buf(size_t(pw) * size_t(ph));
+
+    // columns in [first, last[ are read as a run, the others get mirrored
+    const int first = std::min(pw, std::max(0, -x0));
+    const int last = std::max(first, std::min(pw, m.width - x0));
+
+    for (int j = 0; j < ph; ++j) {
+        const uint8_t *line = m.data + mirror(y - border + j, m.height) * m.stride;
+        uint8_t *out = buf.data() + j * pw;
+
+        auto at = [&](int i) {
+            const int sx = mirror(x0 + i, m.width);
+            if (!m.wide)
+                return line[sx];
+            uint16_t v;
+            std::memcpy(&v, line + sx * 2, 2);
+            return narrow(v, m.shift);
+        };
+
+        for (int i = 0; i < first; ++i)
+            out[i] = at(i);
+        if (m.wide && last > first)
+            narrowLine(line + (x0 + first) * 2, last - first, m.shift, out + first);
+        else if (last > first)
+            std::memcpy(out + first, line + x0 + first, size_t(last - first));
+        for (int i = last; i < pw; ++i)
+            out[i] = at(i);
+    }
+    return buf;
+}
+
+// 16 bits to 8 bits gray, rounded as Qt does
+inline uint8_t gray16To8(uint16_t v) {
+    return uint8_t((v - (v >> 8) + 0x80) >> 8);
+}
+
+inline int16_t saturate16(int v) {
+    return int16_t(std::max(-32768, std::min(v, 32767)));
+}
+
+/*
+ * YUV to RGB in 16 bits lanes, with the same saturations in both paths:
+ * y' = (y - offset) * scale + 32, then r = y' + v * rv, g = y' - (u * gu +
+ * v * gv), b = y' + u * bu, shifted right by 6 bits and clamped to 8 bits.
+ * Chroma values are centered on 0.
+ */
+inline uint32_t yuvPixel(const YuvMatrix &m, int y, int u, int v) {
+    const int ys = (y - m.y_offset) * m.y_scale + 32;
+    const int r = saturate16(ys + v * m.rv) >> 6;
+    const int g = saturate16(ys - (u * m.gu + v * m.gv)) >> 6;
+    const int b = saturate16(ys + u * m.bu) >> 6;
+    return xrgb(clamp8(r), clamp8(g), clamp8(b));
+}
+
+#ifdef PAL_KERNELS_SSE2
+struct YuvVectors {
+    explicit YuvVectors(const YuvMatrix &m)
+        : offset(_mm_set1_epi16(m.y_offset))
+        , scale(_mm_set1_epi16(m.y_scale))
+        , rounding(_mm_set1_epi16(32))
+        , chroma(_mm_set1_epi16(128))
+        , rv(_mm_set1_epi16(m.rv))
+        , gu(_mm_set1_epi16(m.gu))
+        , gv(_mm_set1_epi16(m.gv))
+        , bu(_mm_set1_epi16(m.bu))
+    {}
+
+    // 8 pixels from 16 bits samples, u and v not yet centered
+    void convert(__m128i y, __m128i u, __m128i v, __m128i &r, __m128i &g, __m128i &b) const {
+        const __m128i ys = _mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(y, offset), scale), rounding);
+        u = _mm_sub_epi16(u, chroma);
+        v = _mm_sub_epi16(v, chroma);
+        r = _mm_srai_epi16(_mm_adds_epi16(ys, _mm_mullo_epi16(v, rv)), 6);
+        g = _mm_srai_epi16(_mm_subs_epi16(ys, _mm_add_epi16(_mm_mullo_epi16(u, gu), _mm_mullo_epi16(v, gv))), 6);
+        b = _mm_srai_epi16(_mm_adds_epi16(ys, _mm_mullo_epi16(u, bu)), 6);
+    }
+
+    // 16 pixels, chroma samples holding 8 values for pixels pairs each
+    void store(uint32_t *dst, __m128i y8, __m128i u, __m128i v) const {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i r0, g0, b0, r1, g1, b1;
+        convert(_mm_unpacklo_epi8(y8, zero), _mm_unpacklo_epi16(u, u), _mm_unpacklo_epi16(v, v), r0, g0, b0);
+        convert(_mm_unpackhi_epi8(y8, zero), _mm_unpackhi_epi16(u, u), _mm_unpackhi_epi16(v, v), r1, g1, b1);
+        storeXrgb(dst, _mm_packus_epi16(r0, r1), _mm_packus_epi16(g0, g1), _mm_packus_epi16(b0, b1));
+    }
+
+    __m128i offset, scale, rounding, chroma, rv, gu, gv, bu;
+};
+#endif
+
+void yuvLine(const YuvImage &src, const YuvMatrix &m, int line, uint32_t *out) {
+    const int w = src.width;
+    const uint8_t *py = src.planes[0] + line * src.strides[0];
+    int x = 0;
+
+#ifdef PAL_KERNELS_SSE2
+    const YuvVectors k(m);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i low = _mm_set1_epi16(0x00ff);
+#endif
+
+    switch (src.layout) {
+    case YuvLayout::NV12: {
+        const uint8_t *puv = src.planes[1] + (line / 2) * src.strides[1];
+#ifdef PAL_KERNELS_SSE2
+        for (; x + 16 <= w; x += 16) {
+            const __m128i uv = load128(puv + x);
+            k.store(out + x, load128(py + x), _mm_and_si128(uv, low), _mm_srli_epi16(uv, 8));
+        }
+#endif
+        for (; x < w; ++x)
+            out[x] = yuvPixel(m, py[x], puv[(x / 2) * 2] - 128, puv[(x / 2) * 2 + 1] - 128);
+        break;
+    }
+    case YuvLayout::I420: {
+        const uint8_t *pu = src.planes[1] + (line / 2) * src.strides[1];
+        const uint8_t *pv = src.planes[2] + (line / 2) * src.strides[2];
+#ifdef PAL_KERNELS_SSE2
+        for (; x + 16 <= w; x += 16) {
+            const __m128i u = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(pu + x / 2)), zero);
+            const __m128i v = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(pv + x / 2)), zero);
+            k.store(out + x, load128(py + x), u, v);
+        }
+#endif
+        for (; x < w; ++x)
+            out[x] = yuvPixel(m, py[x], pu[x / 2] - 128, pv[x / 2] - 128);
+        break;
+    }
+    case YuvLayout::YUYV: {
+#ifdef PAL_KERNELS_SSE2
+        const __m128i low32 = _mm_set1_epi32(0xffff);
+        for (; x + 16 <= w; x += 16) {
+            const __m128i a = load128(py + 2 * x);
+            const __m128i b = load128(py + 2 * x + 16);
+            const __m128i y8 = _mm_packus_epi16(_mm_and_si128(a, low), _mm_and_si128(b, low));
+
+            // chroma of 4 pixel pairs per register, u in the low half of 32 bits lanes
+            const __m128i ca = _mm_srli_epi16(a, 8);
+            const __m128i cb = _mm_srli_epi16(b, 8);
+            const __m128i ua = _mm_and_si128(ca, low32);
+            const __m128i ub = _mm_and_si128(cb, low32);
+            const __m128i va = _mm_srli_epi32(ca, 16);
+            const __m128i vb = _mm_srli_epi32(cb, 16);
+
+            // 8 u and v values, one per pixel pair
+            const __m128i u = _mm_packs_epi32(ua, ub);
+            const __m128i v = _mm_packs_epi32(va, vb);
+            k.store(out + x, y8, u, v);
+        }
+#endif
+        for (; x < w; ++x)
+            out[x] = yuvPixel(m, py[2 * x], py[(x / 2) * 4 + 1] - 128, py[(x / 2) * 4 + 3] - 128);
+        break;
+    }
+    }
+}
+
+/*
+ * Composite layers map samples to [0, 255] in 16 bits lanes: d = min(max(v -
+ * low, 0), range) is shifted left until range uses 16 bits, t = d * gain >>
+ * 16 then gets clamped to 255. Rounding the gain up makes high map to 255.
+ * Color components are t * c / 255, rounded.
+ */
+struct LayerGain {
+    explicit LayerGain(const CompositeLayer &layer)
+        : low(layer.low)
+        , range(uint16_t(std::max(1, int(layer.high) - int(layer.low))))
+        , shift(0)
+    {
+        while ((range << shift) < 0x8000)
+            ++shift;
+        const uint32_t scaled = uint32_t(range) << shift;
+        gain = uint16_t((255u * 65536u + scaled - 1) / scaled);
+        for (int c = 0; c < 3; ++c)
+            color[c] = layer.color[c];
+    }
+
+    uint16_t low;
+    uint16_t range;
+    int shift;
+    uint16_t gain;
+    uint16_t color[3];
+};
+
+inline int scaleColor(int t, int c) {
+    const int x = t * c;
+    return (x + (x >> 8) + 128) >> 8;
+}
+
+inline int layerLevel(const LayerGain &g, int v) {
+    const int d = std::min(std::max(v - int(g.low), 0), int(g.range)) << g.shift;
+    return std::min((d * g.gain) >> 16, 255);
+}
+
+inline int luma(uint32_t p) {
+    return int((((p >> 16) & 0xff) * 77 + ((p >> 8) & 0xff) * 150 + (p & 0xff) * 29) >> 8);
+}
+
+/*
+ * Position of a coordinate between area centers: the first area and the
+ * weight of the next one, in 8 bits fixed point. Coordinates before the first
+ * center or after the last one get a single area.
+ */
+struct AreaWeight {
+    int first;
+    int second;
+    int weight;
+};
+
+inline AreaWeight areaWeight(int pos, int size, int regions) {
+    const double f = (double(pos) + 0.5) * regions / size - 0.5;
+    const int i = int(std::floor(f));
+    AreaWeight a;
+    if (i < 0) {
+        a.first = a.second = 0;
+        a.weight = 0;
+    }
+    else if (i >= regions - 1) {
+        a.first = a.second = regions - 1;
+        a.weight = 0;
+    }
+    else {
+        a.first = i;
+        a.second = i + 1;
+        a.weight = int((f - i) * 256.0 + 0.5);
+    }
+    return a;
+}
+
+} // namespace
+
+void rotate32(const uint8_t *src, ptrdiff_t src_stride, int width, int height,
+              uint8_t *dst, ptrdiff_t dst_stride, int quarter)
+{
+    quarter = ((quarter % 4) + 4) % 4;
+
+    if (quarter == 0) {
+        for (int y = 0; y < height; ++y)
+            std::memcpy(dst + y * dst_stride, src + y * src_stride, size_t(width) * 4);
+        return;
+    }
+
+    if (quarter == 2) {
+        rotateHalfTurn(src, src_stride, width, height, dst, dst_stride);
+        return;
+    }
+
+    for (int by = 0; by < height; by += rotate_block) {
+        for (int bx = 0; bx < width; bx += rotate_block) {
+            rotateBlock(src, src_stride, width, height, dst, dst_stride,
+                        bx, by, std::min(bx + rotate_block, width), std::min(by + rotate_block, height),
+                        quarter == 1);
+        }
+    }
+}
+
+uint64_t hashBlock(const uint8_t *src, ptrdiff_t stride, int bytes, int height) {
+    HashState state;
+
+    for (int y = 0; y < height; ++y) {
+        const uint8_t *line = src + y * stride;
+        int x = 0;
+        for (; x + 16 <= bytes; x += 16) {
+            state.chunk(line + x, ((x % hash_block) / 16) * 2);
+            if ((x + 16) % hash_block == 0)
+                state.scramble();
+        }
+
+        if (x < bytes) {
+            uint8_t tail[16] = {};
+            std::memcpy(tail, line + x, size_t(bytes - x));
+            state.chunk(tail, ((x % hash_block) / 16) * 2);
+        }
+        if (bytes % hash_block != 0)
+            state.scramble();
+    }
+
+    const uint64_t length = uint64_t(bytes) * uint64_t(height);
+    return avalanche(state.lane(0) ^ (state.lane(1) * 0xc2b2ae3d27d4eb4fULL) ^ length);
+}
+
+void halve32(const uint8_t *src, ptrdiff_t src_stride, int width, int height,
+             uint8_t *dst, ptrdiff_t dst_stride)
+{
+    const int ow = (width + 1) / 2;
+    const int oh = (height + 1) / 2;
+
+    for (int j = 0; j < oh; ++j) {
+        const uint32_t *a = line32(src, src_stride, 2 * j);
+        const uint32_t *b = line32(src, src_stride, std::min(2 * j + 1, height - 1));
+        uint32_t *d = line32(dst, dst_stride, j);
+        int i = 0;
+#ifdef PAL_KERNELS_SSE2
+        for (; 2 * i + 8 <= width; i += 4) {
+            const __m128 v0 = _mm_castsi128_ps(_mm_avg_epu8(load128(a + 2 * i), load128(b + 2 * i)));
+            const __m128 v1 = _mm_castsi128_ps(_mm_avg_epu8(load128(a + 2 * i + 4), load128(b + 2 * i + 4)));
+            const __m128i even = _mm_castps_si128(_mm_shuffle_ps(v0, v1, _MM_SHUFFLE(2, 0, 2, 0)));
+            const __m128i odd = _mm_castps_si128(_mm_shuffle_ps(v0, v1, _MM_SHUFFLE(3, 1, 3, 1)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(d + i), _mm_avg_epu8(even, odd));
+        }
+#endif
+        for (; i < ow; ++i) {
+            const int x0 = 2 * i;
+            const int x1 = std::min(x0 + 1, width - 1);
+            d[i] = average4(average4(a[x0], b[x0]), average4(a[x1], b[x1]));
+        }
+    }
+}
+
+/*
+ * Bilinear interpolation, from the horizontal, vertical, diagonal and cross
+ * averages of every position. Red and blue positions take green from the
+ * cross and the other color from the diagonals, green positions take the
+ * color of their line horizontally and the other one vertically.
+ */
+void demosaicBilinear(const BayerMosaic &src, int x, int y, int w, int h,
+                      uint8_t *dst, ptrdiff_t dst_stride)
+{
+    if (w <= 0 || h <= 0)
+        return;
+
+    int ps = 0;
+    const std::vector<uint8_t> buf = gatherWindow(src, x, y, w, h, 1, ps);
+    int rx = 0, ry = 0;
+    redPosition(src.pattern, rx, ry);
+
+    for (int j = 0; j < h; ++j) {
+        const uint8_t *u = buf.data() + j * ps + 1;
+        const uint8_t *c = u + ps;
+        const uint8_t *d = c + ps;
+        uint32_t *out = line32(dst, dst_stride, j);
+
+        // the color of the line is red or blue, found on alternate columns
+        const bool red_line = ((y + j) & 1) == ry;
+        const int color_x = red_line ? rx : 1 - rx;
+        int i = 0;
+
+#ifdef PAL_KERNELS_SSE2
+        const __m128i even = _mm_set1_epi16(0x00ff);
+        const __m128i mask = ((x & 1) == color_x) ? even : _mm_slli_epi16(even, 8);
+        for (; i + 16 <= w; i += 16) {
+            const __m128i cv = load128(c + i);
+            const __m128i hv = _mm_avg_epu8(load128(c + i - 1), load128(c + i + 1));
+            const __m128i vv = _mm_avg_epu8(load128(u + i), load128(d + i));
+            const __m128i xv = _mm_avg_epu8(_mm_avg_epu8(load128(u + i - 1), load128(u + i + 1)),
+                                            _mm_avg_epu8(load128(d + i - 1), load128(d + i + 1)));
+            const __m128i pv = _mm_avg_epu8(hv, vv);
+
+            const __m128i own = select(mask, cv, hv);
+            const __m128i green = select(mask, pv, cv);
+            const __m128i other = select(mask, xv, vv);
+            if (red_line)
+                storeXrgb(out + i, own, green, other);
+            else
+                storeXrgb(out + i, other, green, own);
+        }
+#endif
+
+        for (; i < w; ++i) {
+            const uint8_t hv = average(c[i - 1], c[i + 1]);
+            const uint8_t vv = average(u[i], d[i]);
+            const bool color = ((x + i) & 1) == color_x;
+            uint8_t own, green, other;
+            if (color) {
+                own = c[i];
+                green = average(hv, vv);
+                other = average(average(u[i - 1], u[i + 1]), average(d[i - 1], d[i + 1]));
+            }
+            else {
+                own = hv;
+                green = c[i];
+                other = vv;
+            }
+            out[i] = red_line ? xrgb(own, green, other) : xrgb(other, green, own);
+        }
+    }
+}
+
+/*
+ * Gradient corrected bilinear interpolation (Malvar, He and Cutler, 2004):
+ * bilinear estimates are corrected by the laplacian of the sample at hand,
+ * with 5x5 filters. Weights are doubled to stay integer.
+ */
+void demosaicGradient(const BayerMosaic &src, int x, int y, int w, int h,
+                      uint8_t *dst, ptrdiff_t dst_stride)
+{
+    if (w <= 0 || h <= 0)
+        return;
+
+    int ps = 0;
+    const std::vector<uint8_t> buf = gatherWindow(src, x, y, w, h, 2, ps);
+    int rx = 0, ry = 0;
+    redPosition(src.pattern, rx, ry);
+
+    for (int j = 0; j < h; ++j) {
+        const uint8_t *c = buf.data() + (j + 2) * ps + 2;
+        uint32_t *out = line32(dst, dst_stride, j);
+        const bool red_line = ((y + j) & 1) == ry;
+        const int color_x = red_line ? rx : 1 - rx;
+
+        for (int i = 0; i < w; ++i) {
+            auto p = [&](int dx, int dy) { return int(c[dy * ps + i + dx]); };
+            const int center = p(0, 0);
+            const int h1 = p(-1, 0) + p(1, 0);
+            const int v1 = p(0, -1) + p(0, 1);
+            const int h2 = p(-2, 0) + p(2, 0);
+            const int v2 = p(0, -2) + p(0, 2);
+            const int diag = p(-1, -1) + p(1, -1) + p(-1, 1) + p(1, 1);
+
+            int own, green, other;
+            if (((x + i) & 1) == color_x) {
+                own = center;
+                green = clamp8((8 * center + 4 * (h1 + v1) - 2 * (h2 + v2) + 8) >> 4);
+                other = clamp8((12 * center + 4 * diag - 3 * (h2 + v2) + 8) >> 4);
+            }
+            else {
+                own = clamp8((10 * center + 8 * h1 - 2 * h2 - 2 * diag + v2 + 8) >> 4);
+                green = center;
+                other = clamp8((10 * center + 8 * v1 - 2 * v2 - 2 * diag + h2 + 8) >> 4);
+            }
+            out[i] = red_line ? xrgb(own, green, other) : xrgb(other, green, own);
+        }
+    }
+}
+
+void demosaicHalf(const BayerMosaic &src, int x, int y, int w, int h,
+                  uint8_t *dst, ptrdiff_t dst_stride)
+{
+    if (w <= 0 || h <= 0)
+        return;
+
+    int ps = 0;
+    const std::vector<uint8_t> buf = gatherWindow(src, 2 * x, 2 * y, 2 * w, 2 * h, 0, ps);
+    int rx = 0, ry = 0;
+    redPosition(src.pattern, rx, ry);
+
+    for (int j = 0; j < h; ++j) {
+        // the line holding red samples, and the one holding blue ones
+        const uint8_t *lr = buf.data() + (2 * j + ry) * ps;
+        const uint8_t *lb = buf.data() + (2 * j + 1 - ry) * ps;
+        uint32_t *out = line32(dst, dst_stride, j);
+        int i = 0;
+
+#ifdef PAL_KERNELS_SSE2
+        const __m128i low = _mm_set1_epi16(0x00ff);
+        for (; i + 16 <= w; i += 16) {
+            const __m128i r0 = load128(lr + 2 * i);
+            const __m128i r1 = load128(lr + 2 * i + 16);
+            const __m128i b0 = load128(lb + 2 * i);
+            const __m128i b1 = load128(lb + 2 * i + 16);
+            const __m128i r_even = _mm_packus_epi16(_mm_and_si128(r0, low), _mm_and_si128(r1, low));
+            const __m128i r_odd = _mm_packus_epi16(_mm_srli_epi16(r0, 8), _mm_srli_epi16(r1, 8));
+            const __m128i b_even = _mm_packus_epi16(_mm_and_si128(b0, low), _mm_and_si128(b1, low));
+            const __m128i b_odd = _mm_packus_epi16(_mm_srli_epi16(b0, 8), _mm_srli_epi16(b1, 8));
+
+            const __m128i red = rx ? r_odd : r_even;
+            const __m128i blue = rx ? b_even : b_odd;
+            const __m128i green = _mm_avg_epu8(rx ? r_even : r_odd, rx ? b_odd : b_even);
+            storeXrgb(out + i, red, green, blue);
+        }
+#endif
+
+        for (; i < w; ++i) {
+            const uint8_t red = lr[2 * i + rx];
+            const uint8_t blue = lb[2 * i + 1 - rx];
+            const uint8_t green = average(lr[2 * i + 1 - rx], lb[2 * i + rx]);
+            out[i] = xrgb(red, green, blue);
+        }
+    }
+}
+
+YuvMatrix yuvMatrix(bool bt709, bool full_range) {
+    // Kr and Kb of both standards, ranges of 219 and 224 levels when limited
+    const double kr = bt709 ? 0.2126 : 0.299;
+    const double kb = bt709 ? 0.0722 : 0.114;
+    const double kg = 1.0 - kr - kb;
+    const double ys = full_range ? 1.0 : 255.0 / 219.0;
+    const double cs = full_range ? 1.0 : 255.0 / 224.0;
+
+    auto fixed = [](double v) { return int16_t(v * 64.0 + 0.5); };
+    YuvMatrix m;
+    m.y_offset = full_range ? 0 : 16;
+    m.y_scale = fixed(ys);
+    m.rv = fixed(2.0 * (1.0 - kr) * cs);
+    m.gu = fixed(2.0 * (1.0 - kb) * kb / kg * cs);
+    m.gv = fixed(2.0 * (1.0 - kr) * kr / kg * cs);
+    m.bu = fixed(2.0 * (1.0 - kb) * cs);
+    return m;
+}
+
+void yuvToXrgb(const YuvImage &src, const YuvMatrix &m, int y0, int y1,
+               uint8_t *dst, ptrdiff_t dst_stride)
+{
+    for (int y = y0; y < y1; ++y)
+        yuvLine(src, m, y, line32(dst, dst_stride, y - y0));
+}
+
+void grayToXrgb(const uint8_t *src, int count, uint32_t *dst) {
+    int i = 0;
+#ifdef PAL_KERNELS_SSE2
+    for (; i + 16 <= count; i += 16) {
+        const __m128i g = load128(src + i);
+        storeXrgb(dst + i, g, g, g);
+    }
+#endif
+    for (; i < count; ++i)
+        dst[i] = xrgb(src[i], src[i], src[i]);
+}
+
+void gray16ToXrgb(const uint8_t *src, int count, uint32_t *dst) {
+    const uint16_t *s = reinterpret_cast<const uint16_t*>(src);
+    int i = 0;
+#ifdef PAL_KERNELS_SSE2
+    const __m128i half = _mm_set1_epi16(0x80);
+    for (; i + 16 <= count; i += 16) {
+        const __m128i a = load128(s + i);
+        const __m128i b = load128(s + i + 8);
+        const __m128i a8 = _mm_srli_epi16(_mm_add_epi16(_mm_sub_epi16(a, _mm_srli_epi16(a, 8)), half), 8);
+        const __m128i b8 = _mm_srli_epi16(_mm_add_epi16(_mm_sub_epi16(b, _mm_srli_epi16(b, 8)), half), 8);
+        const __m128i g = _mm_packus_epi16(a8, b8);
+        storeXrgb(dst + i, g, g, g);
+    }
+#endif
+    for (; i < count; ++i) {
+        const uint8_t g = gray16To8(s[i]);
+        dst[i] = xrgb(g, g, g);
+    }
+}
+
+void rgb888ToXrgb(const uint8_t *src, int count, uint32_t *dst) {
+    int i = 0;
+#ifdef PAL_KERNELS_SSSE3
+    // 4 pixels per 12 bytes, loads reading 4 bytes ahead
+    const __m128i order = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+    const __m128i alpha = _mm_set1_epi32(int(0xff000000));
+    for (; i + 6 <= count; i += 4) {
+        const __m128i v = _mm_shuffle_epi8(load128(src + 3 * i), order);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_or_si128(v, alpha));
+    }
+#elif defined(PAL_KERNELS_SSE2)
+    // 4 pixels per 12 bytes, gathered as the 32 bits words starting at every
+    // pixel, whose red and blue bytes then get swapped
+    const __m128i green = _mm_set1_epi32(0x0000ff00);
+    const __m128i low = _mm_set1_epi32(0x000000ff);
+    const __m128i alpha = _mm_set1_epi32(int(0xff000000));
+    for (; i + 6 <= count; i += 4) {
+        const __m128i v = load128(src + 3 * i);
+        const __m128i p01 = _mm_unpacklo_epi32(v, _mm_srli_si128(v, 3));
+        const __m128i p23 = _mm_unpacklo_epi32(_mm_srli_si128(v, 6), _mm_srli_si128(v, 9));
+        const __m128i p = _mm_unpacklo_epi64(p01, p23);
+        const __m128i r = _mm_slli_epi32(_mm_and_si128(p, low), 16);
+        const __m128i b = _mm_and_si128(_mm_srli_epi32(p, 16), low);
+        const __m128i out = _mm_or_si128(_mm_or_si128(r, b), _mm_or_si128(_mm_and_si128(p, green), alpha));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), out);
+    }
+#endif
+    for (; i < count; ++i)
+        dst[i] = xrgb(src[3 * i], src[3 * i + 1], src[3 * i + 2]);
+}
+
+void indexedToXrgb(const uint8_t *src, int count, const uint32_t *table, uint32_t *dst) {
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        dst[i] = table[src[i]];
+        dst[i + 1] = table[src[i + 1]];
+        dst[i + 2] = table[src[i + 2]];
+        dst[i + 3] = table[src[i + 3]];
+    }
+    for (; i < count; ++i)
+        dst[i] = table[src[i]];
+}
+
+void compositeToXrgb(const CompositeLayer *layers, int count, int x, int y, int w, int h, int step,
+                     uint8_t *dst, ptrdiff_t dst_stride)
+{
+    if (w <= 0 || h <= 0)
+        return;
+
+    std::vector<LayerGain> gains;
+    for (int l = 0; l < count; ++l)
+        gains.emplace_back(layers[l]);
+
+    // samples of every layer for the current line, widened to 16 bits
+    std::vector<uint16_t> samples(size_t(count) * size_t(w));
+
+    for (int j = 0; j < h; ++j) {
+        const ptrdiff_t line = ptrdiff_t(y + j) * step;
+        for (int l = 0; l < count; ++l) {
+            const CompositeLayer &layer = layers[l];
+            const uint8_t *src = layer.data + line * layer.stride;
+            uint16_t *out = samples.data() + l * w;
+            if (layer.wide) {
+                const uint16_t *s16 = reinterpret_cast<const uint16_t*>(src);
+                for (int i = 0; i < w; ++i)
+                    out[i] = s16[(x + i) * step];
+            }
+            else {
+                for (int i = 0; i < w; ++i)
+                    out[i] = src[(x + i) * step];
+            }
+        }
+
+        uint32_t *out = line32(dst, dst_stride, j);
+        int i = 0;
+
+#ifdef PAL_KERNELS_SSE2
+        const __m128i max8 = _mm_set1_epi16(255);
+        const __m128i half = _mm_set1_epi16(128);
+        for (; i + 16 <= w; i += 16) {
+            __m128i acc[2][3];
+            for (int half_i = 0; half_i < 2; ++half_i)
+                for (int c = 0; c < 3; ++c)
+                    acc[half_i][c] = _mm_setzero_si128();
+
+            for (int l = 0; l < count; ++l) {
+                const LayerGain &g = gains[size_t(l)];
+                const __m128i low = _mm_set1_epi16(short(g.low));
+                const __m128i range = _mm_set1_epi16(short(g.range));
+                const __m128i gain = _mm_set1_epi16(short(g.gain));
+                const __m128i shift = _mm_cvtsi32_si128(g.shift);
+
+                for (int half_i = 0; half_i < 2; ++half_i) {
+                    const __m128i v = load128(samples.data() + l * w + i + half_i * 8);
+                    __m128i d = _mm_subs_epu16(v, low);
+                    d = _mm_sub_epi16(range, _mm_subs_epu16(range, d));
+                    __m128i t = _mm_mulhi_epu16(_mm_sll_epi16(d, shift), gain);
+                    t = _mm_sub_epi16(t, _mm_subs_epu16(t, max8));
+
+                    for (int c = 0; c < 3; ++c) {
+                        const __m128i x = _mm_mullo_epi16(t, _mm_set1_epi16(short(g.color[c])));
+                        const __m128i scaled = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), half), 8);
+                        acc[half_i][c] = _mm_adds_epu16(acc[half_i][c], scaled);
+                    }
+                }
+            }
+
+            storeXrgb(out + i, _mm_packus_epi16(acc[0][0], acc[1][0]),
+                      _mm_packus_epi16(acc[0][1], acc[1][1]), _mm_packus_epi16(acc[0][2], acc[1][2]));
+        }
+#endif
+
+        for (; i < w; ++i) {
+            int rgb[3] = {0, 0, 0};
+            for (int l = 0; l < count; ++l) {
+                const LayerGain &g = gains[size_t(l)];
+                const int t = layerLevel(g, samples[size_t(l * w + i)]);
+                for (int c = 0; c < 3; ++c)
+                    rgb[c] += scaleColor(t, g.color[c]);
+            }
+            out[i] = xrgb(std::min(rgb[0], 255), std::min(rgb[1], 255), std::min(rgb[2], 255));
+        }
+    }
+}
+
+void claheTable(const uint8_t *src, ptrdiff_t stride, int width, int height, int regions,
+                int region_x, int region_y, double clip_limit, int step, uint8_t *table)
+{
+    const int x0 = int(int64_t(region_x) * width / regions);
+    const int x1 = int(int64_t(region_x + 1) * width / regions);
+    const int y0 = int(int64_t(region_y) * height / regions);
+    const int y1 = int(int64_t(region_y + 1) * height / regions);
+
+    uint32_t hist[256] = {};
+    uint32_t total = 0;
+    for (int y = y0; y < y1; y += step) {
+        const uint32_t *line = reinterpret_cast<const uint32_t*>(src + y * stride);
+        for (int x = x0; x < x1; x += step) {
+            ++hist[luma(line[x])];
+            ++total;
+        }
+    }
+
+    if (total == 0) {
+        for (int v = 0; v < 256; ++v)
+            table[v] = uint8_t(v);
+        return;
+    }
+
+    // clip, then spread the excess evenly, the remainder one count per bin
+    // at regular intervals
+    const uint32_t limit = std::max(uint32_t(1), uint32_t(clip_limit * total / 256));
+    uint32_t excess = 0;
+    for (int v = 0; v < 256; ++v) {
+        if (hist[v] > limit) {
+            excess += hist[v] - limit;
+            hist[v] = limit;
+        }
+    }
+
+    const uint32_t spread = excess / 256;
+    uint32_t rest = excess % 256;
+    for (int v = 0; v < 256; ++v)
+        hist[v] += spread;
+    if (rest > 0) {
+        const int interval = int(256 / rest);
+        for (int v = 0; v < 256 && rest > 0; v += interval, --rest)
+            ++hist[v];
+    }
+
+    uint64_t cdf = 0;
+    for (int v = 0; v < 256; ++v) {
+        cdf += hist[v];
+        table[v] = uint8_t((cdf * 255 + total / 2) / total);
+    }
+}
+
+void claheApply(const uint8_t *src, ptrdiff_t stride, int width, int height, int regions,
+                const uint8_t *tables, int x, int y, int w, int h, int step,
+                uint8_t *dst, ptrdiff_t dst_stride)
+{
+    std::vector<int> columns(size_t(std::max(w, 0)));
+    std::vector<AreaWeight> weights(columns.size());
+    for (int i = 0; i < w; ++i) {
+        columns[size_t(i)] = std::min((x + i) * step, width - 1);
+        weights[size_t(i)] = areaWeight(columns[size_t(i)], width, regions);
+    }
+
+    for (int j = 0; j < h; ++j) {
+        const int sy = std::min((y + j) * step, height - 1);
+        const AreaWeight row = areaWeight(sy, height, regions);
+        const uint8_t *top = tables + size_t(row.first * regions) * 256;
+        const uint8_t *bottom = tables + size_t(row.second * regions) * 256;
+        const uint32_t *line = reinterpret_cast<const uint32_t*>(src + sy * stride);
+        uint32_t *out = reinterpret_cast<uint32_t*>(dst + j * dst_stride);
+
+        for (int i = 0; i < w; ++i) {
+            const AreaWeight &col = weights[size_t(i)];
+            const uint32_t p = line[columns[size_t(i)]];
+            const int l = luma(p);
+            const int a = l + col.first * 256;
+            const int b = l + col.second * 256;
+            const int t = top[a] * (256 - col.weight) + top[b] * col.weight;
+            const int u = bottom[a] * (256 - col.weight) + bottom[b] * col.weight;
+            const int v = (t * (256 - row.weight) + u * row.weight + (1 << 15)) >> 16;
+
+            // colors follow their luma, 16 bits fixed point gain
+            const uint32_t gain = (uint32_t(v) << 16) / uint32_t(std::max(l, 1));
+            const uint32_t cap = p >> 24;
+            uint32_t q = p & 0xff000000;
+            for (int shift = 0; shift < 24; shift += 8) {
+                const uint32_t c = (((p >> shift) & 0xff) * gain + (1 << 15)) >> 16;
+                q |= std::min(c, cap) << shift;
+            }
+            out[i] = q;
+        }
+    }
+}
+
+} // namespace kernels
+} // namespace pal
@@ -0,0 +1,172 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Pixel kernels working on raw buffers. They do not depend on Qt, are
+ * thread-safe and vectorized where the instruction set allows it.
+ */
+
+namespace pal {
+namespace kernels {
+
+/**
+ * Copy a block of 32 bits pixels rotated by quarter * 90 degrees clockwise.
+ *
+ * The destination is width x height pixels large for even quarters, and
+ * height x width for odd ones. Source and destination may not overlap.
+ */
+void rotate32(const uint8_t *src, ptrdiff_t src_stride, int width, int height,
+              uint8_t *dst, ptrdiff_t dst_stride, int quarter);
+
+/**
+ * Fast non cryptographic 64 bits hash of a block of height lines of bytes
+ * bytes each, meant to tell whether image content changed.
+ *
+ * Results do not depend on the instruction set, but may change between
+ * versions of the library and must not be stored.
+ */
+uint64_t hashBlock(const uint8_t *src, ptrdiff_t stride, int bytes, int height);
+
+/**
+ * Halve a block of 32 bits pixels in both directions, averaging 2x2 squares
+ * channel by channel. The destination is (width + 1) / 2 x (height + 1) / 2
+ * pixels large, the last column and line are repeated for odd sizes.
+ */
+void halve32(const uint8_t *src, ptrdiff_t src_stride, int width, int height,
+             uint8_t *dst, ptrdiff_t dst_stride);
+
+/// Bayer mosaic layouts, named after their top left 2x2 cell
+enum class Bayer {
+    RGGB,
+    BGGR,
+    GRBG,
+    GBRG
+};
+
+/**
+ * A raw Bayer mosaic of width x height samples. Samples are 8 bits, or 16
+ * bits shifted right by shift when wide is set.
+ */
+struct BayerMosaic {
+    const uint8_t *data;
+    ptrdiff_t stride;
+    int width;
+    int height;
+    Bayer pattern;
+    bool wide;
+    int shift;
+};
+
+/**
+ * Demosaic the window (x, y, w, h) of a mosaic into 32 bits 0xffRRGGBB
+ * pixels, mirroring the mosaic at its borders.
+ *
+ * The bilinear variant is vectorized. The gradient corrected one, after
+ * Malvar, He and Cutler, is sharper but slower.
+ */
+void demosaicBilinear(const BayerMosaic &src, int x, int y, int w, int h,
+                      uint8_t *dst, ptrdiff_t dst_stride);
+void demosaicGradient(const BayerMosaic &src, int x, int y, int w, int h,
+                      uint8_t *dst, ptrdiff_t dst_stride);
+
+/**
+ * Half resolution demosaic, every 2x2 cell of the mosaic gives one pixel.
+ * The window (x, y, w, h) is in output pixels.
+ */
+void demosaicHalf(const BayerMosaic &src, int x, int y, int w, int h,
+                  uint8_t *dst, ptrdiff_t dst_stride);
+
+/**
+ * Convert a line of count pixels to 32 bits 0xffRRGGBB pixels, from 8 or
+ * 16 bits grayscale, from RGB888 bytes, or from 8 bits indexes into a table
+ * of 256 opaque colors.
+ */
+void grayToXrgb(const uint8_t *src, int count, uint32_t *dst);
+void gray16ToXrgb(const uint8_t *src, int count, uint32_t *dst);
+void rgb888ToXrgb(const uint8_t *src, int count, uint32_t *dst);
+void indexedToXrgb(const uint8_t *src, int count, const uint32_t *table, uint32_t *dst);
+
+/// A single channel image blended by compositeToXrgb()
+struct CompositeLayer {
+    const uint8_t *data;
+    ptrdiff_t stride;
+    bool wide;          // 16 bits samples
+    uint16_t low;       // sample shown black
+    uint16_t high;      // sample shown at full color
+    uint8_t color[3];   // red, green and blue
+};
+
+/**
+ * Blend layers additively into 32 bits 0xffRRGGBB pixels. Samples are mapped
+ * linearly from [low, high] to [0, 255], scaled by the color of their layer
+ * and summed with saturation.
+ *
+ * The window (x, y, w, h) is in units of step samples, one sample out of
+ * step being taken in both directions.
+ */
+void compositeToXrgb(const CompositeLayer *layers, int count, int x, int y, int w, int h, int step,
+                     uint8_t *dst, ptrdiff_t dst_stride);
+
+/**
+ * Contrast limited adaptive histogram equalization (CLAHE) of 32 bits
+ * pixels, on their luma. The image is split in regions x regions areas.
+ *
+ * claheTable() computes the 256 entries equalization table of the area
+ * (region_x, region_y) from its luma histogram, clipped at clip_limit times
+ * the mean bin count, the excess being spread over all bins. One pixel out of
+ * step is sampled in both directions.
+ *
+ * claheApply() maps the window (x, y, w, h) of the image sampled every step
+ * pixels, interpolating bilinearly between the tables of the 4 nearest area
+ * centers, tables holding the regions x regions tables in rows. Colors are
+ * scaled with their luma, and kept within alpha for premultiplied pixels.
+ */
+void claheTable(const uint8_t *src, ptrdiff_t stride, int width, int height, int regions,
+                int region_x, int region_y, double clip_limit, int step, uint8_t *table);
+void claheApply(const uint8_t *src, ptrdiff_t stride, int width, int height, int regions,
+                const uint8_t *tables, int x, int y, int w, int h, int step,
+                uint8_t *dst, ptrdiff_t dst_stride);
+
+/// YUV layouts: 4:2:0 semi-planar and planar, 4:2:2 packed
+enum class YuvLayout {
+    NV12,
+    I420,
+    YUYV
+};
+
+/**
+ * A YUV image. Planes are Y then interleaved UV for NV12, Y, U and V for
+ * I420, and the packed samples alone for YUYV.
+ */
+struct YuvImage {
+    const uint8_t *planes[3];
+    ptrdiff_t strides[3];
+    int width;
+    int height;
+    YuvLayout layout;
+};
+
+/// YUV to RGB matrix, in 6 bits fixed point
+struct YuvMatrix {
+    int16_t y_offset;
+    int16_t y_scale;
+    int16_t rv;
+    int16_t gu;
+    int16_t gv;
+    int16_t bu;
+};
+
+/// BT.601 or BT.709 matrix, for limited (16-235) or full range samples
+YuvMatrix yuvMatrix(bool bt709, bool full_range);
+
+/**
+ * Convert the lines [y0, y1[ of a YUV image to 32 bits 0xffRRGGBB pixels,
+ * dst pointing to the destination of line y0. Chroma samples are shared by
+ * the pixels they cover. The width of YUYV images must be even.
+ */
+void yuvToXrgb(const YuvImage &src, const YuvMatrix &m, int y0, int y1,
+               uint8_t *dst, ptrdiff_t dst_stride);
+
+} // namespace kernels
+} // namespace pal
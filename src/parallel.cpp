@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <QRunnable>
+#include <QThreadPool>
+#include "parallel.h"
+
+namespace pal {
+namespace detail {
+
+namespace {
+
+/*
+ * Indices are handed out by an atomic counter. The state is shared with the
+ * runnables, which may start after parallelFor() returned, in which case they
+ * find nothing left to do.
+ */
+struct ParallelState {
+    explicit ParallelState(int count, const std::function<void(int)> &body)
+        : body(&body)
+        , count(count)
+        , next(0)
+        , done(0)
+    {}
+
+    // runs indices until there are none left
+    void work() {
+        int ran = 0;
+        for (int i = next.fetch_add(1); i < count; i = next.fetch_add(1)) {
+            (*body)(i);
+            ++ran;
+        }
+        if (ran > 0 && done.fetch_add(ran) + ran == count) {
+            std::lock_guard<std::mutex> lock(mutex);
+            cond.notify_all();
+        }
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [this] { return done.load() == count; });
+    }
+
+    const std::function<void(int)> *body;
+    const int count;
+    std::atomic<int> next;
+    std::atomic<int> done;
+    std::mutex mutex;
+    std::condition_variable cond;
+};
+
+class ParallelTask : public QRunnable {
+public:
+    explicit ParallelTask(std::shared_ptr<ParallelState> state)
+        : m_state(std::move(state))
+    {}
+
+    void run() override {
+        m_state->work();
+    }
+
+private:
+    std::shared_ptr<ParallelState> m_state;
+};
+
+class AsyncTask : public QRunnable {
+public:
+    explicit AsyncTask(std::function<void()> task)
+        : m_task(std::move(task))
+    {}
+
+    void run() override {
+        m_task();
+    }
+
+private:
+    std::function<void()> m_task;
+};
+
+} // namespace
+
+void parallelFor(int count, const std::function<void(int)> &body) {
+    if (count <= 0)
+        return;
+    if (count == 1) {
+        body(0);
+        return;
+    }
+
+    auto state = std::make_shared<ParallelState>(count, body);
+    QThreadPool *pool = QThreadPool::globalInstance();
+    const int helpers = std::min(count, pool->maxThreadCount()) - 1;
+    for (int i = 0; i < helpers; ++i)
+        pool->start(new ParallelTask(state));
+
+    state->work();
+    state->wait();
+}
+
+void runAsync(std::function<void()> task) {
+    QThreadPool::globalInstance()->start(new AsyncTask(std::move(task)));
+}
+
+} // namespace detail
+} // namespace pal
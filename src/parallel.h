@@ -0,0 +1,21 @@
+#pragma once
+#include <functional>
+
+namespace pal {
+namespace detail {
+
+/**
+ * Run body(0) to body(count - 1) on the global thread pool, the calling
+ * thread taking its share. Returns once every call is done.
+ *
+ * Pool threads that are busy elsewhere are not waited for, the calling thread
+ * runs what they did not pick up. Pool threads may call it as well, ending up
+ * running most of the work themselves when the pool is busy.
+ */
+void parallelFor(int count, const std::function<void(int)> &body);
+
+/// Run a task on the global thread pool, returning right away
+void runAsync(std::function<void()> task);
+
+} // namespace detail
+} // namespace pal
@@ -0,0 +1,420 @@
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <vector>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include "pal/pyramid-cache.h"
+#include "kernels.h"
+#include "parallel.h"
+#include "tile-source.h"
+
+namespace pal {
+namespace detail {
+
+/*
+ * Pyramid file layout, in native byte order: a header, the UTF-8 path of the
+ * source image, the offsets of all the tiles, level after level and line of
+ * tiles after line of tiles, then the tiles. Tiles are 32 bits pixels without
+ * padding between lines, at 64 bytes aligned offsets.
+ */
+const char pyramid_magic[8] = {'P', 'I', 'V', 'P', 'Y', 'R', '0', '1'};
+const int pyramid_tile = 256;
+
+struct PyramidHeader {
+    char magic[8];
+    quint32 width;
+    quint32 height;
+    quint32 format;        // QImage::Format
+    quint32 levels;
+    quint32 tile_size;
+    quint32 path_size;     // bytes
+    qint64 source_mtime;   // ms since the epoch
+    qint64 source_size;
+};
+
+static qint64 align(qint64 pos, qint64 alignment) {
+    return (pos + alignment - 1) / alignment * alignment;
+}
+
+static QSize levelSize(const QSize &size, int level) {
+    const qint64 f = qint64(1) << level;
+    return QSize(int((size.width() + f - 1) / f), int((size.height() + f - 1) / f));
+}
+
+// levels down to the first one that fits in a tile
+static int levelCount(const QSize &size) {
+    int levels = 1;
+    for (QSize s = size; std::max(s.width(), s.height()) > pyramid_tile; s = levelSize(size, levels - 1))
+        ++levels;
+    return levels;
+}
+
+static QRect tileRect(const QSize &level_size, int index) {
+    const int columns = (level_size.width() + pyramid_tile - 1) / pyramid_tile;
+    const QRect r((index % columns) * pyramid_tile, (index / columns) * pyramid_tile, pyramid_tile, pyramid_tile);
+    return r & QRect(QPoint(), level_size);
+}
+
+static qint64 tileCount(const QSize &level_size) {
+    return ((level_size.width() + qint64(pyramid_tile) - 1) / pyramid_tile)
+         * ((level_size.height() + qint64(pyramid_tile) - 1) / pyramid_tile);
+}
+
+// Halve a 32 bits image in bands of lines spread over the thread pool
+static QImage halve(const QImage &image) {
+    QImage half((image.width() + 1) / 2, (image.height() + 1) / 2, image.format());
+    if (half.isNull())
+        return half;
+
+    const int band = 64;  // even, so that bands halve independently
+    const uchar *src = image.constBits();
+    uchar *dst = half.bits();
+    const ptrdiff_t src_bpl = image.bytesPerLine();
+    const ptrdiff_t dst_bpl = half.bytesPerLine();
+    parallelFor((image.height() + band - 1) / band, [&](int i) {
+        const int y = i * band;
+        kernels::halve32(src + y * src_bpl, src_bpl, image.width(), std::min(band, image.height() - y),
+                         dst + (y / 2) * dst_bpl, dst_bpl);
+    });
+    return half;
+}
+
+// A pyramid file mapped in memory, validated against its source
+class PyramidFile {
+public:
+    bool open(const QString &file_name, const QString &path, qint64 mtime, qint64 size) {
+        m_file.setFileName(file_name);
+        if (!m_file.open(QIODevice::ReadOnly) || m_file.size() < qint64(sizeof(PyramidHeader)))
+            return false;
+
+        m_size = m_file.size();
+        m_data = m_file.map(0, m_size);
+        if (!m_data)
+            return false;
+
+        std::memcpy(&m_header, m_data, sizeof(m_header));
+        const QByteArray utf8 = path.toUtf8();
+        if (std::memcmp(m_header.magic, pyramid_magic, sizeof(pyramid_magic)) != 0
+            || m_header.source_mtime != mtime || m_header.source_size != size
+            || m_header.width == 0 || m_header.width > quint32(INT_MAX)
+            || m_header.height == 0 || m_header.height > quint32(INT_MAX)
+            || m_header.tile_size != quint32(pyramid_tile) || m_header.levels == 0
+            || m_header.levels > quint32(levelCount(imageSize()))
+            || (m_header.format != quint32(QImage::Format_RGB32)
+                && m_header.format != quint32(QImage::Format_ARGB32_Premultiplied))
+            || m_header.path_size != quint32(utf8.size())
+            || qint64(sizeof(m_header)) + utf8.size() > m_size
+            || std::memcmp(m_data + sizeof(m_header), utf8.constData(), size_t(utf8.size())) != 0)
+            return false;
+
+        // every tile must lie within the file
+        const qint64 table = align(qint64(sizeof(m_header)) + utf8.size(), 8);
+        qint64 count = 0;
+        for (int l = 0; l < int(m_header.levels); ++l) {
+            m_first.push_back(int(count));
+            count += tileCount(levelSize(imageSize(), l));
+        }
+        if (table + count * 8 > m_size)
+            return false;
+
+        m_offsets = reinterpret_cast<const quint64*>(m_data + table);
+        for (int l = 0; l < int(m_header.levels); ++l) {
+            const QSize ls = levelSize(imageSize(), l);
+            for (int i = 0; i < tileCount(ls); ++i) {
+                const QRect r = tileRect(ls, i);
+                const quint64 offset = m_offsets[m_first[size_t(l)] + i];
+                if (offset % 4 != 0 || offset > quint64(m_size)
+                    || qint64(offset) + qint64(r.width()) * r.height() * 4 > m_size)
+                    return false;
+            }
+        }
+
+        // recently opened files are evicted last
+        m_file.setFileTime(QDateTime::currentDateTimeUtc(), QFileDevice::FileModificationTime);
+        return true;
+    }
+
+    QSize imageSize() const {
+        return QSize(int(m_header.width), int(m_header.height));
+    }
+
+    QImage::Format format() const {
+        return QImage::Format(m_header.format);
+    }
+
+    int levels() const {
+        return int(m_header.levels);
+    }
+
+    const uchar *tile(int level, int index) const {
+        return m_data + m_offsets[m_first[size_t(level)] + index];
+    }
+
+private:
+    QFile m_file;
+    const uchar *m_data = nullptr;
+    qint64 m_size = 0;
+    PyramidHeader m_header;
+    const quint64 *m_offsets = nullptr;
+    std::vector<int> m_first;  // index of the first tile of every level
+};
+
+static void releaseMapping(void *info) {
+    delete static_cast<std::shared_ptr<const PyramidFile>*>(info);
+}
+
+/*
+ * Displays a mapped pyramid. Areas matching a tile, as PixmapItem asks for,
+ * wrap the mapping without copying, others are copied from their tiles.
+ */
+class PyramidSource : public TileSource {
+public:
+    explicit PyramidSource(std::shared_ptr<const PyramidFile> file)
+        : m_file(std::move(file))
+    {}
+
+    QSize size() const override {
+        return m_file->imageSize();
+    }
+
+protected:
+    int nativeLevels() const override {
+        return m_file->levels();
+    }
+
+    QImage renderNative(const QRect &rect, int level, bool refined) const override {
+        Q_UNUSED(refined)
+
+        const QSize ls = levelSize(size(), level);
+        const int columns = (ls.width() + pyramid_tile - 1) / pyramid_tile;
+        const int first = (rect.y() / pyramid_tile) * columns + rect.x() / pyramid_tile;
+        if (rect == tileRect(ls, first)) {
+            // the image keeps the mapping alive
+            return QImage(m_file->tile(level, first), rect.width(), rect.height(), rect.width() * 4,
+                          m_file->format(), releaseMapping, new std::shared_ptr<const PyramidFile>(m_file));
+        }
+
+        QImage out(rect.size(), m_file->format());
+        if (out.isNull())
+            return out;
+        out.fill(Qt::transparent);
+
+        const QRect area = rect & QRect(QPoint(), ls);
+        if (area.isEmpty())
+            return out;
+        for (int ty = area.top() / pyramid_tile; ty <= area.bottom() / pyramid_tile; ++ty) {
+            for (int tx = area.left() / pyramid_tile; tx <= area.right() / pyramid_tile; ++tx) {
+                const int index = ty * columns + tx;
+                const QRect r = tileRect(ls, index);
+                const QRect part = r & area;
+                const uchar *tile = m_file->tile(level, index);
+                for (int y = part.top(); y <= part.bottom(); ++y)
+                    std::memcpy(out.scanLine(y - rect.y()) + (part.x() - rect.x()) * 4,
+                                tile + (qint64(y - r.y()) * r.width() + (part.x() - r.x())) * 4,
+                                size_t(part.width()) * 4);
+            }
+        }
+        return out;
+    }
+
+private:
+    std::shared_ptr<const PyramidFile> m_file;
+};
+
+} // namespace detail
+
+
+PyramidCache::PyramidCache(const QString &directory)
+    : m_directory(directory.isEmpty()
+                  ? QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QStringLiteral("/pal-pyramids")
+                  : directory)
+    , m_capacity(qint64(4) * 1024 * 1024 * 1024)
+{}
+
+PyramidCache::~PyramidCache() = default;
+
+QString PyramidCache::directory() const {
+    return m_directory;
+}
+
+qint64 PyramidCache::capacity() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_capacity;
+}
+
+void PyramidCache::setCapacity(qint64 bytes) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_capacity = bytes;
+    evict(QString());
+}
+
+qint64 PyramidCache::diskUsage() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    qint64 bytes = 0;
+    const QDir dir(m_directory);
+    for (const QFileInfo &info : dir.entryInfoList({QStringLiteral("*.pivp")}, QDir::Files))
+        bytes += info.size();
+    return bytes;
+}
+
+// file named after a hash of the source identity
+QString PyramidCache::cacheFile(const QString &path) const {
+    const QFileInfo info(path);
+    const QString canonical = info.canonicalFilePath();
+    if (canonical.isEmpty())
+        return QString();
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(canonical.toUtf8());
+    hash.addData(QByteArray::number(info.lastModified().toMSecsSinceEpoch()));
+    hash.addData(QByteArray::number(info.size()));
+    return m_directory + QLatin1Char('/') + QString::fromLatin1(hash.result().toHex()) + QStringLiteral(".pivp");
+}
+
+bool PyramidCache::contains(const QString &path) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const QString file = cacheFile(path);
+    return !file.isEmpty() && QFile::exists(file);
+}
+
+bool PyramidCache::insert(const QString &path, const QImage &image) {
+    const QFileInfo info(path);
+    const QString canonical = info.canonicalFilePath();
+    if (canonical.isEmpty() || image.isNull()) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_error = canonical.isEmpty() ? QStringLiteral("No such image file") : QStringLiteral("Null image");
+        return false;
+    }
+
+    QImage level = image.convertToFormat(image.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied
+                                                                 : QImage::Format_RGB32);
+    const QSize size = level.size();
+    const QByteArray utf8 = canonical.toUtf8();
+
+    detail::PyramidHeader h;
+    std::memcpy(h.magic, detail::pyramid_magic, sizeof(h.magic));
+    h.width = quint32(size.width());
+    h.height = quint32(size.height());
+    h.format = quint32(level.format());
+    h.levels = quint32(detail::levelCount(size));
+    h.tile_size = quint32(detail::pyramid_tile);
+    h.path_size = quint32(utf8.size());
+    h.source_mtime = info.lastModified().toMSecsSinceEpoch();
+    h.source_size = info.size();
+
+    std::vector<quint64> offsets;
+    qint64 count = 0;
+    for (int l = 0; l < int(h.levels); ++l)
+        count += detail::tileCount(detail::levelSize(size, l));
+    const qint64 table = detail::align(qint64(sizeof(h)) + utf8.size(), 8);
+    qint64 pos = detail::align(table + count * 8, 64);
+    for (int l = 0; l < int(h.levels); ++l) {
+        const QSize ls = detail::levelSize(size, l);
+        for (int i = 0; i < detail::tileCount(ls); ++i) {
+            const QRect r = detail::tileRect(ls, i);
+            offsets.push_back(quint64(pos));
+            pos = detail::align(pos + qint64(r.width()) * r.height() * 4, 64);
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    const QString file_name = cacheFile(path);
+    QDir().mkpath(m_directory);
+    lock.unlock();
+
+    // written aside and renamed, readers never see partial files
+    QSaveFile file(file_name);
+    const QByteArray padding(64, '\0');
+    auto pad = [&](qint64 to) {
+        return file.write(padding.constData(), to - file.pos()) == to - file.pos();
+    };
+
+    bool ok = file.open(QIODevice::WriteOnly)
+           && file.write(reinterpret_cast<const char*>(&h), sizeof(h)) == qint64(sizeof(h))
+           && file.write(utf8) == utf8.size()
+           && pad(table)
+           && file.write(reinterpret_cast<const char*>(offsets.data()), count * 8) == count * 8;
+
+    size_t next = 0;
+    for (int l = 0; ok && l < int(h.levels); ++l) {
+        if (l > 0)
+            level = detail::halve(level);
+        ok = !level.isNull();
+        for (int i = 0; ok && i < detail::tileCount(level.size()); ++i) {
+            const QRect r = detail::tileRect(level.size(), i);
+            ok = pad(qint64(offsets[next++]));
+            for (int y = r.top(); ok && y <= r.bottom(); ++y) {
+                const qint64 bytes = qint64(r.width()) * 4;
+                ok = file.write(reinterpret_cast<const char*>(level.constScanLine(y)) + r.x() * 4, bytes) == bytes;
+            }
+        }
+    }
+
+    lock.lock();
+    if (!ok || !file.commit()) {
+        m_error = file.errorString();
+        file.cancelWriting();
+        return false;
+    }
+    evict(file_name);
+    return true;
+}
+
+void PyramidCache::remove(const QString &path) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const QString file = cacheFile(path);
+    if (!file.isEmpty())
+        QFile::remove(file);
+}
+
+void PyramidCache::clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    QDir dir(m_directory);
+    for (const QString &name : dir.entryList({QStringLiteral("*.pivp")}, QDir::Files))
+        dir.remove(name);
+}
+
+QString PyramidCache::errorString() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_error;
+}
+
+std::shared_ptr<detail::TileSource> PyramidCache::source(const QString &path) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const QString file_name = cacheFile(path);
+    if (file_name.isEmpty() || !QFile::exists(file_name))
+        return nullptr;
+
+    const QFileInfo info(path);
+    auto file = std::make_shared<detail::PyramidFile>();
+    if (!file->open(file_name, info.canonicalFilePath(), info.lastModified().toMSecsSinceEpoch(), info.size())) {
+        m_error = QStringLiteral("Invalid pyramid file");
+        return nullptr;
+    }
+    return std::make_shared<detail::PyramidSource>(std::move(file));
+}
+
+// whole files go, least recently opened or written first
+void PyramidCache::evict(const QString &keep) const {
+    const QDir dir(m_directory);
+    QFileInfoList files = dir.entryInfoList({QStringLiteral("*.pivp")}, QDir::Files, QDir::Time);
+    qint64 total = 0;
+    for (const QFileInfo &info : files)
+        total += info.size();
+
+    // the list is sorted newest first, walk it from the oldest
+    for (int i = int(files.size()) - 1; i >= 0 && total > m_capacity; --i) {
+        if (files[i].absoluteFilePath() == QFileInfo(keep).absoluteFilePath())
+            continue;
+        if (QFile::remove(files[i].absoluteFilePath()))
+            total -= files[i].size();
+    }
+}
+
+} // namespace pal
@@ -0,0 +1,132 @@
+#pragma once
+#include <atomic>
+#include <QElapsedTimer>
+#include "pal/image-viewer.h"
+
+// Statistics collection can be compiled out entirely
+#ifndef PAL_IMAGE_VIEWER_STATS
+#define PAL_IMAGE_VIEWER_STATS 1
+#endif
+
+namespace pal {
+namespace detail {
+
+/**
+ * Counters backing RenderStats.
+ *
+ * Every update is gated by an atomic flag, so that the cost of disabled
+ * statistics is a relaxed load, or nothing at all when compiled out.
+ */
+class StatsCounters {
+public:
+    bool isEnabled() const {
+#if PAL_IMAGE_VIEWER_STATS
+        return m_enabled.load(std::memory_order_relaxed);
+#else
+        return false;
+#endif
+    }
+
+    void setEnabled(bool on) {
+        m_enabled.store(on, std::memory_order_relaxed);
+    }
+
+    void reset() {
+        conversion_ns = 0;
+        upload_ns = 0;
+        paint_ns = 0;
+        paint_total_ns = 0;
+        paint_count = 0;
+        frames_submitted = 0;
+        frames_presented = 0;
+        frames_dropped = 0;
+        frames_unchanged = 0;
+        tiles_updated = 0;
+        tiles_unchanged = 0;
+        pending_present = false;
+    }
+
+    void addPaint(qint64 ns) {
+        paint_ns.store(ns, std::memory_order_relaxed);
+        paint_total_ns.fetch_add(ns, std::memory_order_relaxed);
+        paint_count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // a new frame replaces one that has not been painted yet
+    void frameSubmitted() {
+        frames_submitted.fetch_add(1, std::memory_order_relaxed);
+        if (pending_present.exchange(true, std::memory_order_relaxed))
+            frames_dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void framePainted() {
+        if (pending_present.exchange(false, std::memory_order_relaxed))
+            frames_presented.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    RenderStats snapshot() const {
+        RenderStats s;
+        s.conversionTime = conversion_ns.load(std::memory_order_relaxed);
+        s.uploadTime = upload_ns.load(std::memory_order_relaxed);
+        s.paintTime = paint_ns.load(std::memory_order_relaxed);
+        const quint64 count = paint_count.load(std::memory_order_relaxed);
+        s.averagePaintTime = count ? paint_total_ns.load(std::memory_order_relaxed) / qint64(count) : 0;
+        s.framesSubmitted = frames_submitted.load(std::memory_order_relaxed);
+        s.framesPresented = frames_presented.load(std::memory_order_relaxed);
+        s.framesDropped = frames_dropped.load(std::memory_order_relaxed);
+        s.framesUnchanged = frames_unchanged.load(std::memory_order_relaxed);
+        s.tilesUpdated = tiles_updated.load(std::memory_order_relaxed);
+        s.tilesUnchanged = tiles_unchanged.load(std::memory_order_relaxed);
+        s.memoryUsage = memory_bytes.load(std::memory_order_relaxed)
+                      + tile_bytes.load(std::memory_order_relaxed)
+                      + texture_bytes.load(std::memory_order_relaxed);
+        return s;
+    }
+
+    std::atomic<qint64> conversion_ns{0};
+    std::atomic<qint64> upload_ns{0};
+    std::atomic<qint64> paint_ns{0};
+    std::atomic<qint64> paint_total_ns{0};
+    std::atomic<quint64> paint_count{0};
+    std::atomic<quint64> frames_submitted{0};
+    std::atomic<quint64> frames_presented{0};
+    std::atomic<quint64> frames_dropped{0};
+    std::atomic<quint64> frames_unchanged{0};
+    std::atomic<quint64> tiles_updated{0};
+    std::atomic<quint64> tiles_unchanged{0};
+    std::atomic<qint64> memory_bytes{0};
+    std::atomic<qint64> tile_bytes{0};
+    std::atomic<qint64> texture_bytes{0};
+    std::atomic<bool> pending_present{false};
+
+private:
+    std::atomic<bool> m_enabled{false};
+};
+
+/**
+ * Stores the time spent in a scope into a counter, if statistics are enabled
+ */
+class ScopedTimer {
+public:
+    ScopedTimer(const StatsCounters &stats, std::atomic<qint64> &target)
+        : m_target(stats.isEnabled() ? &target : nullptr)
+    {
+        if (m_target)
+            m_timer.start();
+    }
+
+    ~ScopedTimer() {
+        if (m_target)
+            m_target->store(m_timer.nsecsElapsed(), std::memory_order_relaxed);
+    }
+
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer& operator=(const ScopedTimer &) = delete;
+
+private:
+    std::atomic<qint64> *m_target;
+    QElapsedTimer m_timer;
+};
+
+} // namespace detail
+} // namespace pal
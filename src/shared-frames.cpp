@@ -0,0 +1,392 @@
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <QTimer>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "pal/shared-frames.h"
+
+namespace pal {
+
+using shm::RingHeader;
+using shm::SlotHeader;
+
+static size_t align64(size_t n) {
+    return (n + 63) & ~size_t(63);
+}
+
+static size_t slotStride(uint32_t slot_size) {
+    return align64(sizeof(SlotHeader) + slot_size);
+}
+
+static size_t ringSize(uint32_t slot_count, uint32_t slot_size) {
+    return align64(sizeof(RingHeader)) + slot_count * slotStride(slot_size);
+}
+
+static RingHeader *ringHeader(uchar *data) {
+    return reinterpret_cast<RingHeader*>(data);
+}
+
+static SlotHeader *slotHeader(uchar *data, quint32 index) {
+    const RingHeader *ring = ringHeader(data);
+    return reinterpret_cast<SlotHeader*>(data + align64(sizeof(RingHeader)) + index * slotStride(ring->slot_size));
+}
+
+static uchar *slotData(SlotHeader *slot) {
+    return reinterpret_cast<uchar*>(slot) + sizeof(SlotHeader);
+}
+
+// the reader is checked first, the consumer moving it to previous before replacing it
+static bool isHeld(const RingHeader *ring, quint32 index) {
+    return ring->reader.load() == index || ring->previous.load() == index;
+}
+
+static qint64 steadyNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// shared memory object names are a single component starting with a slash
+static QByteArray shmName(const QString &name) {
+    return name.startsWith(QLatin1Char('/')) ? name.toLocal8Bit() : '/' + name.toLocal8Bit();
+}
+
+static QString systemError(const QString &what) {
+    return QStringLiteral("%1: %2").arg(what, QString::fromLocal8Bit(std::strerror(errno)));
+}
+
+
+SharedFrameWriter::SharedFrameWriter()
+    : m_data(nullptr)
+    , m_size(0)
+    , m_next(0)
+    , m_sequence(0)
+{}
+
+SharedFrameWriter::~SharedFrameWriter() {
+    close();
+}
+
+bool SharedFrameWriter::create(const QString &name, int slot_count, qint64 slot_size) {
+    close();
+
+    if (slot_count < 4 || slot_size <= 0 || slot_size > 0x7fffffff) {
+        m_error = QStringLiteral("Invalid ring buffer geometry");
+        return false;
+    }
+
+    const QByteArray path = shmName(name);
+    ::shm_unlink(path.constData());
+
+    const int fd = ::shm_open(path.constData(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        m_error = systemError(QStringLiteral("shm_open"));
+        return false;
+    }
+
+    const size_t size = ringSize(quint32(slot_count), quint32(slot_size));
+    void *data = MAP_FAILED;
+    if (::ftruncate(fd, off_t(size)) == 0)
+        data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        m_error = systemError(QStringLiteral("mmap"));
+        ::close(fd);
+        ::shm_unlink(path.constData());
+        return false;
+    }
+    ::close(fd);
+
+    m_name = name;
+    m_data = static_cast<uchar*>(data);
+    m_size = size;
+    m_next = 0;
+    m_sequence = 0;
+
+    auto ring = new (m_data) RingHeader;
+    ring->version = shm::ring_version;
+    ring->slot_count = quint32(slot_count);
+    ring->slot_size = quint32(slot_size);
+    ring->sequence.store(0);
+    ring->latest.store(shm::no_slot);
+    ring->reader.store(shm::no_slot);
+    ring->previous.store(shm::no_slot);
+    for (quint32 i = 0; i < ring->slot_count; ++i)
+        new (slotHeader(m_data, i)) SlotHeader{};
+
+    // consumers only attach to fully initialized rings
+    std::atomic_thread_fence(std::memory_order_release);
+    reinterpret_cast<std::atomic<uint32_t>*>(&ring->magic)->store(shm::ring_magic, std::memory_order_release);
+    return true;
+}
+
+void SharedFrameWriter::close() {
+    if (!m_data)
+        return;
+    ::munmap(m_data, m_size);
+    ::shm_unlink(shmName(m_name).constData());
+    m_data = nullptr;
+    m_size = 0;
+}
+
+bool SharedFrameWriter::isOpen() const {
+    return m_data != nullptr;
+}
+
+QString SharedFrameWriter::errorString() const {
+    return m_error;
+}
+
+quint64 SharedFrameWriter::publish(const QImage &image) {
+    if (!m_data || image.isNull())
+        return 0;
+
+    RingHeader *ring = ringHeader(m_data);
+    const qint64 bytes = qint64(image.bytesPerLine()) * image.height();
+    if (bytes > qint64(ring->slot_size)) {
+        m_error = QStringLiteral("Frame larger than the ring buffer slots");
+        return 0;
+    }
+
+    const quint32 count = ring->slot_count;
+    const quint32 latest = ring->latest.load(std::memory_order_relaxed);
+
+    for (quint32 n = 0; n < count; ++n) {
+        const quint32 index = (m_next + n) % count;
+        if (index == latest || isHeld(ring, index))
+            continue;
+
+        // claim the slot, unless the consumer took it in the meantime
+        SlotHeader *slot = slotHeader(m_data, index);
+        const quint64 previous = slot->sequence.load(std::memory_order_relaxed);
+        slot->sequence.store(0);
+        if (isHeld(ring, index)) {
+            slot->sequence.store(previous);
+            continue;
+        }
+
+        slot->width = quint32(image.width());
+        slot->height = quint32(image.height());
+        slot->stride = quint32(image.bytesPerLine());
+        slot->format = quint32(image.format());
+        std::memcpy(slotData(slot), image.constBits(), size_t(bytes));
+        slot->timestamp = steadyNow();
+
+        const quint64 sequence = m_sequence + 1;
+        slot->sequence.store(sequence, std::memory_order_release);
+        ring->latest.store(index, std::memory_order_release);
+        ring->sequence.store(sequence, std::memory_order_release);
+
+        m_next = index + 1;
+        m_sequence = sequence;
+        return sequence;
+    }
+
+    m_error = QStringLiteral("No free slot in the ring buffer");
+    return 0;
+}
+
+
+/*
+ * The mapping is shared by the source and every image it delivered, the last
+ * one to go unmaps it, so that images remain readable after close().
+ */
+struct SharedFrameSource::Mapping {
+    uchar *data;
+    size_t size;
+    std::atomic<int> refs;
+
+    // a delivered image and the slot it points into
+    struct Frame {
+        Mapping *map;
+        quint32 slot;
+    };
+
+    static void release(void *info) {
+        auto map = static_cast<Mapping*>(info);
+        if (map->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            ::munmap(map->data, map->size);
+            delete map;
+        }
+    }
+
+    // the slot of a replaced frame is given back once its image is gone
+    static void releaseFrame(void *info) {
+        auto frame = static_cast<Frame*>(info);
+        quint32 slot = frame->slot;
+        ringHeader(frame->map->data)->previous.compare_exchange_strong(slot, shm::no_slot);
+        release(frame->map);
+        delete frame;
+    }
+};
+
+SharedFrameSource::SharedFrameSource(QObject *parent)
+    : QObject(parent)
+    , m_map(nullptr)
+    , m_timer(new QTimer(this))
+    , m_interval(2)
+    , m_slot(shm::no_slot)
+    , m_sequence(0)
+    , m_received(0)
+    , m_overruns(0)
+    , m_latency(0)
+{
+    m_timer->setTimerType(Qt::PreciseTimer);
+    connect(m_timer, &QTimer::timeout, this, &SharedFrameSource::poll);
+}
+
+SharedFrameSource::~SharedFrameSource() {
+    close();
+}
+
+bool SharedFrameSource::open(const QString &name) {
+    close();
+
+    const int fd = ::shm_open(shmName(name).constData(), O_RDWR, 0);
+    if (fd < 0) {
+        m_error = systemError(QStringLiteral("shm_open"));
+        return false;
+    }
+
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (::fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(RingHeader))
+        data = ::mmap(nullptr, size_t(st.st_size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        m_error = systemError(QStringLiteral("mmap"));
+        return false;
+    }
+
+    const size_t size = size_t(st.st_size);
+    RingHeader *ring = ringHeader(static_cast<uchar*>(data));
+    const quint32 magic = reinterpret_cast<std::atomic<uint32_t>*>(&ring->magic)->load(std::memory_order_acquire);
+    if (magic != shm::ring_magic || ring->version != shm::ring_version || ring->slot_count < 4
+        || ringSize(ring->slot_count, ring->slot_size) > size)
+    {
+        m_error = QStringLiteral("Not a frame ring buffer, or not initialized yet");
+        ::munmap(data, size);
+        return false;
+    }
+
+    m_map = new Mapping{static_cast<uchar*>(data), size, {1}};
+    m_slot = shm::no_slot;
+    m_sequence = 0;
+    m_received = 0;
+    m_overruns = 0;
+    m_latency = 0;
+    m_error.clear();
+
+    if (m_interval > 0)
+        m_timer->start(m_interval);
+    return true;
+}
+
+void SharedFrameSource::close() {
+    if (!m_map)
+        return;
+
+    m_timer->stop();
+    ringHeader(m_map->data)->reader.store(shm::no_slot);
+    ringHeader(m_map->data)->previous.store(shm::no_slot);
+    Mapping::release(m_map);
+    m_map = nullptr;
+    m_slot = shm::no_slot;
+}
+
+bool SharedFrameSource::isOpen() const {
+    return m_map != nullptr;
+}
+
+QString SharedFrameSource::errorString() const {
+    return m_error;
+}
+
+int SharedFrameSource::pollInterval() const {
+    return m_interval;
+}
+
+void SharedFrameSource::setPollInterval(int ms) {
+    m_interval = ms;
+    if (m_map && ms > 0)
+        m_timer->start(ms);
+    else
+        m_timer->stop();
+}
+
+quint64 SharedFrameSource::sequence() const {
+    return m_sequence;
+}
+
+quint64 SharedFrameSource::framesReceived() const {
+    return m_received;
+}
+
+quint64 SharedFrameSource::overruns() const {
+    return m_overruns;
+}
+
+qint64 SharedFrameSource::latency() const {
+    return m_latency;
+}
+
+bool SharedFrameSource::poll() {
+    if (!m_map)
+        return false;
+
+    RingHeader *ring = ringHeader(m_map->data);
+    if (ring->sequence.load(std::memory_order_acquire) == m_sequence)
+        return false;
+
+    // the producer may be reusing the latest slot by the time it is taken,
+    // in which case a newer one got published
+    for (int attempt = 0; attempt < 4; ++attempt) {
+        const quint32 index = ring->latest.load(std::memory_order_acquire);
+        if (index >= ring->slot_count)
+            break;
+
+        SlotHeader *slot = slotHeader(m_map->data, index);
+        const quint64 sequence = slot->sequence.load();
+        if (sequence <= m_sequence)
+            break;
+
+        // the displayed frame stays protected until the new one replaced it
+        if (m_slot != shm::no_slot)
+            ring->previous.store(m_slot);
+        ring->reader.store(index);
+        if (slot->sequence.load() != sequence)
+            continue;
+
+        // the slot is ours, until the next one gets taken and this frame released
+        const auto format = QImage::Format(slot->format);
+        const int depth = slot->format < quint32(QImage::NImageFormats) ? QImage(1, 1, format).depth() : 0;
+        if (slot->width == 0 || slot->height == 0 || depth == 0
+            || qint64(slot->stride) * 8 < qint64(slot->width) * depth
+            || qint64(slot->stride) * slot->height > qint64(ring->slot_size))
+        {
+            m_error = QStringLiteral("Invalid frame geometry");
+            break;
+        }
+
+        if (m_sequence != 0)
+            m_overruns += sequence - m_sequence - 1;
+        m_sequence = sequence;
+        m_slot = index;
+        ++m_received;
+        m_latency = steadyNow() - slot->timestamp;
+
+        m_map->refs.fetch_add(1, std::memory_order_relaxed);
+        const QImage image(static_cast<const uchar*>(slotData(slot)), int(slot->width), int(slot->height), int(slot->stride),
+                           format, &Mapping::releaseFrame, new Mapping::Frame{m_map, index});
+        emit frameReady(image);
+        return true;
+    }
+
+    // give back the slot still being displayed
+    ring->reader.store(m_slot);
+    return false;
+}
+
+} // namespace pal
@@ -0,0 +1,45 @@
+#include <algorithm>
+#include "kernels.h"
+#include "tile-source.h"
+
+namespace pal {
+namespace detail {
+
+TileSource::~TileSource() = default;
+
+QSize TileSource::levelSize(int level) const {
+    const QSize s = size();
+    const int f = 1 << level;
+    return QSize((s.width() + f - 1) / f, (s.height() + f - 1) / f);
+}
+
+bool TileSource::hasRefinement() const {
+    return false;
+}
+
+int TileSource::nativeLevels() const {
+    return 1;
+}
+
+QImage TileSource::render(const QRect &rect, int level, bool refined) const {
+    const int native = std::max(1, nativeLevels()) - 1;
+    if (level <= native)
+        return renderNative(rect, level, refined);
+
+    // the matching area of the deepest native level, halved down to the level
+    const int f = 1 << (level - native);
+    const QRect area = QRect(rect.x() * f, rect.y() * f, rect.width() * f, rect.height() * f)
+                     & QRect(QPoint(), levelSize(native));
+    QImage image = renderNative(area, native, refined);
+
+    for (int l = native; l < level && !image.isNull(); ++l) {
+        QImage half((image.width() + 1) / 2, (image.height() + 1) / 2, image.format());
+        kernels::halve32(image.constBits(), image.bytesPerLine(), image.width(), image.height(),
+                         half.bits(), half.bytesPerLine());
+        image = std::move(half);
+    }
+    return image;
+}
+
+} // namespace detail
+} // namespace pal
@@ -0,0 +1,39 @@
+#pragma once
+#include <QImage>
+#include <QRect>
+#include <QSize>
+
+namespace pal {
+namespace detail {
+
+/**
+ * Image content rendered area by area on demand, for inputs that are costly
+ * to turn into display pixels, so that only what is on screen gets rendered.
+ *
+ * Level n is the image downscaled by 2^n, rounded up. Rendering must be
+ * thread-safe, areas are rendered in parallel.
+ */
+class TileSource {
+public:
+    virtual ~TileSource();
+
+    /// Size of the image at full resolution
+    virtual QSize size() const = 0;
+
+    /// Size of the image at a level
+    QSize levelSize(int level) const;
+
+    /// Whether refined renders look better, worth it once the image stays put
+    virtual bool hasRefinement() const;
+
+    /// Render an area of a level, in level coordinates, as a 32 bits image
+    QImage render(const QRect &rect, int level, bool refined) const;
+
+protected:
+    /// Number of levels rendered natively, deeper ones get downscaled from the last
+    virtual int nativeLevels() const;
+    virtual QImage renderNative(const QRect &rect, int level, bool refined) const = 0;
+};
+
+} // namespace detail
+} // namespace pal
@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <QPainter>
+#include <QTransform>
+#include "pal/view-renderer.h"
+#include "bayer-source.h"
+#include "clahe-source.h"
+#include "parallel.h"
+#include "tile-source.h"
+
+namespace pal {
+
+// Image to view transform, as ImageViewer sets it up
+static QTransform viewTransform(const QSize &image, const ViewParameters &params) {
+    const QRectF bounds(QPointF(), QSizeF(image));
+    qreal sx = params.zoom;
+    qreal sy = params.zoom;
+    if (params.fit) {
+        const QRectF rotated = QTransform().rotate(params.rotation).mapRect(bounds);
+        sx = params.size.width() / rotated.width();
+        sy = params.size.height() / rotated.height();
+        if (params.aspectRatioMode == Qt::KeepAspectRatio)
+            sx = sy = std::min(sx, sy);
+        else if (params.aspectRatioMode == Qt::KeepAspectRatioByExpanding)
+            sx = sy = std::max(sx, sy);
+    }
+
+    const QPointF center = params.center.isNull() ? bounds.center() : params.center;
+    QTransform t;
+    t.translate(params.size.width() / 2., params.size.height() / 2.);
+    t.scale(sx, sy);
+    t.rotate(params.rotation);
+    t.translate(-center.x(), -center.y());
+    return t;
+}
+
+// Area of a level seen through the transform, with a pixel of margin
+static QRect visibleArea(const QTransform &t, const QSize &view, const QSize &level_size, int level) {
+    const QRectF area = t.inverted().mapRect(QRectF(QPointF(), QSizeF(view)));
+    const qreal f = 1 << level;
+    const QRect r(QPoint(int(std::floor(area.left() / f)) - 1, int(std::floor(area.top() / f)) - 1),
+                  QPoint(int(std::ceil(area.right() / f)) + 1, int(std::ceil(area.bottom() / f)) + 1));
+    return r & QRect(QPoint(), level_size);
+}
+
+/*
+ * One pixel out of step of an area of the image, in level coordinates, as 32
+ * bits pixels. Lines in other formats are converted over the sampled span
+ * only, or whole for formats with less than a byte per pixel.
+ */
+static QImage sampleArea(const QImage &image, const QRect &area, int step) {
+    const QImage::Format format = image.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied
+                                                          : QImage::Format_RGB32;
+    QImage out(area.size(), format);
+    if (out.isNull())
+        return out;
+
+    const bool direct = image.format() == format;
+    const bool bytes = image.depth() >= 8;
+    const int first = area.x() * step;
+    const int span = (area.width() - 1) * step + 1;
+
+    for (int y = 0; y < area.height(); ++y) {
+        const int sy = (area.y() + y) * step;
+        const QRgb *src = nullptr;
+        QImage line;
+        if (direct) {
+            src = reinterpret_cast<const QRgb*>(image.constScanLine(sy)) + first;
+        }
+        else {
+            QImage wrapped(image.constScanLine(sy) + (bytes ? first * image.depth() / 8 : 0),
+                           bytes ? span : image.width(), 1, image.bytesPerLine(), image.format());
+            if (image.colorCount() > 0)
+                wrapped.setColorTable(image.colorTable());
+            line = wrapped.convertToFormat(format);
+            src = reinterpret_cast<const QRgb*>(line.constScanLine(0)) + (bytes ? 0 : first);
+        }
+
+        QRgb *dst = reinterpret_cast<QRgb*>(out.scanLine(y));
+        for (int x = 0; x < area.width(); ++x)
+            dst[x] = src[x * step];
+    }
+    return out;
+}
+
+QImage renderView(const QImage &image, const ViewParameters &params) {
+    QImage view(params.size, params.background.alpha() == 255 ? QImage::Format_RGB32
+                                                              : QImage::Format_ARGB32_Premultiplied);
+    if (view.isNull())
+        return view;
+    view.fill(params.background);
+    if (image.isNull())
+        return view;
+
+    // the level is chosen as PixmapItem does for tile sources
+    const QTransform t = viewTransform(image.size(), params);
+    const qreal scale = std::sqrt(std::abs(t.determinant()));
+    int level = 0;
+    while (level < 30 && scale * (2 << level) <= 1.0)
+        ++level;
+    const int step = 1 << level;
+
+    std::shared_ptr<detail::TileSource> source;
+    if (params.bayerPattern != BayerPattern::None && detail::BayerSource::accepts(image)) {
+        source = std::make_shared<detail::BayerSource>(image, params.bayerPattern, params.bayerBits);
+    }
+    else if (params.localContrast) {
+        source = std::make_shared<detail::ClaheSource>(image, params.localContrastRegions,
+                                                       params.localContrastClipLimit);
+    }
+
+    const QSize level_size = source ? source->levelSize(level)
+                                    : QSize((image.width() + step - 1) / step, (image.height() + step - 1) / step);
+    const QRect area = visibleArea(t, params.size, level_size, level);
+
+    QPainter painter(&view);
+    if (!area.isEmpty()) {
+        const QImage pixels = source ? source->render(area, level, true) : sampleArea(image, area, step);
+        painter.setTransform(QTransform::fromScale(step, step) * t);
+        painter.drawImage(area.topLeft(), pixels);
+    }
+
+    painter.setRenderHint(QPainter::Antialiasing, params.antialiasing);
+    for (const ViewOverlay &overlay : params.overlays) {
+        painter.setTransform(t);
+        painter.setPen(overlay.pen);
+        painter.setBrush(overlay.brush);
+        painter.drawPath(overlay.shape);
+
+        if (!overlay.text.isEmpty()) {
+            painter.resetTransform();
+            painter.setPen(overlay.pen.color());
+            painter.drawText(t.map(overlay.shape.boundingRect().topLeft()) + QPointF(2., -4.), overlay.text);
+        }
+    }
+
+    return view;
+}
+
+QVector<QImage> renderViews(const QVector<QImage> &images, const ViewParameters &params) {
+    QVector<QImage> views(images.size());
+    QImage *out = views.data();
+    detail::parallelFor(int(images.size()), [&](int i) {
+        out[i] = renderView(images[i], params);
+    });
+    return views;
+}
+
+} // namespace pal